@@ -1,33 +1,725 @@
+#ifdef CSUM_SELFTEST
+#include <avr/pgmspace.h>
+#if defined(__AVR__)
+#include <avr/io.h>
+#include <util/atomic.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#include <time.h>
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#endif
+
 #include <stdint.h>
+#include <string.h>
 
+#include "net/net.h"
+#include "net/uio.h"
 #include "net/checksum.h"
 
+/**
+ * The partial sum is only defined modulo 0xFFFF (2^16 == 1), so the
+ * optimized variants may carry into any bit and sum words of any width:
+ * after folding all of them give the same checksum as the reference.
+ */
+
 /*!
- * @brief Compute Internet Checksum.
- * RFC 1071: https://tools.ietf.org/html/rfc1071
+ * @brief Reference variant: 16-bit words to 32-bit accumulator
  * @param buf Buffer with data to calculate
  * @param count Length of data buffer in bytes
- * @return 16-bit checksum
+ * @param sum Sum of previous pieces
+ * @return 32-bit partial sum
  */
-uint16_t in_checksum(void *buf, uint16_t count) {
-    uint32_t sum = 0;
-    uint16_t *ptr = buf;
-
-    if (count <= 0)
-        goto out;
+uint32_t in_csum_partial_ref(const void *buf, uint16_t count, uint32_t sum) {
+    const uint16_t *ptr = buf;
 
     while (count > 1) {
         sum += *ptr++;
         count -= 2;
     }
-    
+
     /*  Add left-over byte, if any */
     if (count > 0)
-        sum += *(uint8_t *)ptr;
-    
-    /*  Fold 32-bit sum to 16 bits */
+        sum += *(const uint8_t *)ptr;
+
+    return sum;
+}
+
+/*!
+ * @brief Reference variant of the fused copy and checksum.
+ * Source and destination may be unaligned.
+ * @param src Source data
+ * @param dst Destination buffer
+ * @param count Length of data in bytes
+ * @param sum Sum of previous pieces
+ * @return 32-bit partial sum of copied data
+ */
+static uint32_t csum_partial_copy_ref(const uint8_t *src, uint8_t *dst,
+                                      uint16_t count, uint32_t sum) {
+    while (count > 1) {
+        uint16_t w;
+
+        memcpy(&w, src, 2);
+        memcpy(dst, &w, 2);
+        sum += w;
+        src += 2;
+        dst += 2;
+        count -= 2;
+    }
+
+    if (count > 0) {
+        *dst = *src;
+        sum += *src;
+    }
+
+    return sum;
+}
+
+#if defined(__AVR__)
+
+/*!
+ * @brief Compute the partial Internet Checksum (not folded and
+ * not complemented). Used to sum the data in several pieces.
+ * Blocks of 4 bytes are summed with add-with-carry chain;
+ * carry out of the low word is added to the next word (end-around).
+ * @param buf Buffer with data to calculate
+ * @param count Length of data buffer in bytes
+ * @param sum Sum of previous pieces
+ * @return 32-bit partial sum
+ */
+uint32_t in_csum_partial(const void *buf, uint16_t count, uint32_t sum) {
+    const uint8_t *ptr = buf;
+    uint16_t n = count >> 2;
+
+    if (n) {
+        __asm__ volatile (
+            "1:                         \n\t"
+            "ld   __tmp_reg__, %a[p]+   \n\t"
+            "add  %A[s], __tmp_reg__    \n\t"
+            "ld   __tmp_reg__, %a[p]+   \n\t"
+            "adc  %B[s], __tmp_reg__    \n\t"
+            "ld   __tmp_reg__, %a[p]+   \n\t"
+            "adc  %A[s], __tmp_reg__    \n\t"
+            "ld   __tmp_reg__, %a[p]+   \n\t"
+            "adc  %B[s], __tmp_reg__    \n\t"
+            "adc  %C[s], __zero_reg__   \n\t"
+            "adc  %D[s], __zero_reg__   \n\t"
+            "sbiw %[n], 1               \n\t"
+            "brne 1b                    \n\t"
+            : [s] "+r" (sum), [p] "+e" (ptr), [n] "+w" (n)
+            :
+            : "memory"
+        );
+    }
+
+    return in_csum_partial_ref(ptr, count & 3, sum);
+}
+
+/*!
+ * @brief Copy the data and compute its partial Internet Checksum
+ * in one pass, so each byte is loaded only once.
+ * @param src Source data
+ * @param dst Destination buffer
+ * @param count Length of data in bytes
+ * @param sum Sum of previous pieces
+ * @return 32-bit partial sum of copied data
+ */
+uint32_t csum_partial_copy(const void *src, void *dst, uint16_t count,
+                           uint32_t sum) {
+    const uint8_t *s = src;
+    uint8_t *d = dst;
+    uint16_t n = count >> 2;
+
+    if (n) {
+        __asm__ volatile (
+            "1:                         \n\t"
+            "ld   __tmp_reg__, %a[s]+   \n\t"
+            "st   %a[d]+, __tmp_reg__   \n\t"
+            "add  %A[c], __tmp_reg__    \n\t"
+            "ld   __tmp_reg__, %a[s]+   \n\t"
+            "st   %a[d]+, __tmp_reg__   \n\t"
+            "adc  %B[c], __tmp_reg__    \n\t"
+            "ld   __tmp_reg__, %a[s]+   \n\t"
+            "st   %a[d]+, __tmp_reg__   \n\t"
+            "adc  %A[c], __tmp_reg__    \n\t"
+            "ld   __tmp_reg__, %a[s]+   \n\t"
+            "st   %a[d]+, __tmp_reg__   \n\t"
+            "adc  %B[c], __tmp_reg__    \n\t"
+            "adc  %C[c], __zero_reg__   \n\t"
+            "adc  %D[c], __zero_reg__   \n\t"
+            "sbiw %[n], 1               \n\t"
+            "brne 1b                    \n\t"
+            : [c] "+r" (sum), [s] "+e" (s), [d] "+e" (d), [n] "+w" (n)
+            :
+            : "memory"
+        );
+    }
+
+    return csum_partial_copy_ref(s, d, count & 3, sum);
+}
+
+#elif UINTPTR_MAX > 0xFFFFFFFFU
+
+/*!
+ * @brief Compute the partial Internet Checksum (not folded and
+ * not complemented). Used to sum the data in several pieces.
+ * Host variant: 64-bit words are split into 32-bit halves and
+ * summed to 64-bit accumulator, so carries are never lost.
+ * @param buf Buffer with data to calculate
+ * @param count Length of data buffer in bytes
+ * @param sum Sum of previous pieces
+ * @return 32-bit partial sum
+ */
+uint32_t in_csum_partial(const void *buf, uint16_t count, uint32_t sum) {
+    const uint8_t *ptr = buf;
+    uint64_t acc = sum;
+
+    while (count >= 16) {
+        uint64_t w0, w1;
+
+        memcpy(&w0, ptr, 8);
+        memcpy(&w1, ptr + 8, 8);
+        acc += (uint32_t)w0;
+        acc += w0 >> 32;
+        acc += (uint32_t)w1;
+        acc += w1 >> 32;
+        ptr += 16;
+        count -= 16;
+    }
+    while (count >= 4) {
+        uint32_t w;
+
+        memcpy(&w, ptr, 4);
+        acc += w;
+        ptr += 4;
+        count -= 4;
+    }
+
+    /* fold to 17 bits, so the caller may keep adding to 32-bit sum */
+    acc = (acc & 0xFFFFFFFFU) + (acc >> 32);
+    acc = (acc & 0xFFFFFFFFU) + (acc >> 32);
+    acc = (acc & 0xFFFFU) + (acc >> 16);
+    acc = (acc & 0xFFFFU) + (acc >> 16);
+
+    return in_csum_partial_ref(ptr, count, (uint32_t)acc);
+}
+
+/*!
+ * @brief Copy the data and compute its partial Internet Checksum
+ * in one pass, so each byte is loaded only once.
+ * @param src Source data
+ * @param dst Destination buffer
+ * @param count Length of data in bytes
+ * @param sum Sum of previous pieces
+ * @return 32-bit partial sum of copied data
+ */
+uint32_t csum_partial_copy(const void *src, void *dst, uint16_t count,
+                           uint32_t sum) {
+    const uint8_t *s = src;
+    uint8_t *d = dst;
+    uint64_t acc = sum;
+
+    while (count >= 8) {
+        uint64_t w;
+
+        memcpy(&w, s, 8);
+        memcpy(d, &w, 8);
+        acc += (uint32_t)w;
+        acc += w >> 32;
+        s += 8;
+        d += 8;
+        count -= 8;
+    }
+
+    acc = (acc & 0xFFFFFFFFU) + (acc >> 32);
+    acc = (acc & 0xFFFFFFFFU) + (acc >> 32);
+    acc = (acc & 0xFFFFU) + (acc >> 16);
+    acc = (acc & 0xFFFFU) + (acc >> 16);
+
+    return csum_partial_copy_ref(s, d, count, (uint32_t)acc);
+}
+
+#else
+
+/*!
+ * @brief Compute the partial Internet Checksum (not folded and
+ * not complemented). Used to sum the data in several pieces.
+ * @param buf Buffer with data to calculate
+ * @param count Length of data buffer in bytes
+ * @param sum Sum of previous pieces
+ * @return 32-bit partial sum
+ */
+uint32_t in_csum_partial(const void *buf, uint16_t count, uint32_t sum) {
+    return in_csum_partial_ref(buf, count, sum);
+}
+
+/*!
+ * @brief Copy the data and compute its partial Internet Checksum
+ * in one pass, so each byte is loaded only once.
+ * @param src Source data
+ * @param dst Destination buffer
+ * @param count Length of data in bytes
+ * @param sum Sum of previous pieces
+ * @return 32-bit partial sum of copied data
+ */
+uint32_t csum_partial_copy(const void *src, void *dst, uint16_t count,
+                           uint32_t sum) {
+    return csum_partial_copy_ref(src, dst, count, sum);
+}
+
+#endif
+
+/*!
+ * @brief Fold 32-bit partial sum to 16 bits and complement it
+ * @param sum Partial sum
+ * @return 16-bit checksum
+ */
+uint16_t in_csum_fold(uint32_t sum) {
     while (sum >> 16)
         sum = (sum & 0xffff) + (sum >> 16);
-out:
+
     return (uint16_t)~sum;
 }
+
+/*!
+ * @brief Compute Internet Checksum.
+ * RFC 1071: https://tools.ietf.org/html/rfc1071
+ * @param buf Buffer with data to calculate
+ * @param count Length of data buffer in bytes
+ * @return 16-bit checksum
+ */
+uint16_t in_checksum(void *buf, uint16_t count) {
+    return in_csum_fold(in_csum_partial(buf, count, 0));
+}
+
+/*!
+ * @brief Add the TCP/UDP pseudo header to the partial sum
+ * @param saddr Source IP address
+ * @param daddr Destination IP address
+ * @param len Length of transport header and data
+ * @param proto Transport protocol (e.g. IPPROTO_UDP)
+ * @param sum Partial sum of transport header and data
+ * @return 32-bit partial sum
+ */
+uint32_t csum_tcpudp_nofold(in_addr_t saddr, in_addr_t daddr,
+                            uint16_t len, uint8_t proto, uint32_t sum) {
+    sum += (saddr >> 16) + (saddr & 0xFFFF);
+    sum += (daddr >> 16) + (daddr & 0xFFFF);
+    sum += htons(proto);
+    sum += htons(len);
+
+    return sum;
+}
+
+/*!
+ * @brief Compute TCP/UDP checksum with the pseudo header
+ * @param saddr Source IP address
+ * @param daddr Destination IP address
+ * @param len Length of transport header and data
+ * @param proto Transport protocol (e.g. IPPROTO_UDP)
+ * @param sum Partial sum of transport header and data
+ * @return 16-bit checksum
+ */
+uint16_t csum_tcpudp_magic(in_addr_t saddr, in_addr_t daddr,
+                           uint16_t len, uint8_t proto, uint32_t sum) {
+    return in_csum_fold(csum_tcpudp_nofold(saddr, daddr, len, proto, sum));
+}
+
+/*!
+ * @brief Update the checksum after change of 16-bit field,
+ * without summing the data again.
+ * RFC 1624 (eqn. 3): HC' = ~(~HC + ~m + m')
+ * @param chks Pointer to checksum field
+ * @param from Old value of field, as it is in packet
+ * @param to New value of field, as it is in packet
+ */
+void csum_replace2(uint16_t *chks, uint16_t from, uint16_t to) {
+    uint32_t sum = (uint16_t)~*chks;
+
+    sum += (uint16_t)~from;
+    sum += to;
+
+    *chks = in_csum_fold(sum);
+}
+
+/*!
+ * @brief Update the checksum after change of 32-bit field
+ * (e.g. IP address), without summing the data again.
+ * @param chks Pointer to checksum field
+ * @param from Old value of field, as it is in packet
+ * @param to New value of field, as it is in packet
+ */
+void csum_replace4(uint16_t *chks, uint32_t from, uint32_t to) {
+    uint32_t sum = (uint16_t)~*chks;
+
+    sum += (uint16_t)~from;
+    sum += (uint16_t)~(from >> 16);
+    sum += to & 0xFFFF;
+    sum += to >> 16;
+
+    *chks = in_csum_fold(sum);
+}
+
+/*!
+ * @brief Add the partial sum of a block to the sum.
+ * If block starts at odd offset, its bytes are swapped (RFC 1071).
+ * @param sum Current sum
+ * @param block Partial sum of block
+ * @param offset Offset of block from the start of data
+ * @return New sum
+ */
+static uint32_t in_csum_block_add(uint32_t sum, uint32_t block,
+                                  uint16_t offset) {
+    if (offset & 1) {
+        while (block >> 16)
+            block = (block & 0xffff) + (block >> 16);
+        block = ((block & 0xff) << 8) | (block >> 8);
+    }
+
+    return sum + block;
+}
+
+/*!
+ * @brief Compute the partial Internet Checksum over the buffer data,
+ * including fragments.
+ * @param nb Network buffer
+ * @param offset Offset from the buffer data to start
+ * @param len Length of data to calculate
+ * @param sum Sum of previous pieces
+ * @return 32-bit partial sum
+ */
+uint32_t nb_csum_partial(const struct net_buff_s *nb, uint16_t offset,
+                         uint16_t len, uint32_t sum) {
+    const struct net_buff_s *frag = nb;
+    uint16_t pos = 0;   // offset of current piece from the start of range
+
+    while (frag && len) {
+        uint16_t chunk = nb_headlen(frag);
+
+        if (offset < chunk) {
+            chunk -= offset;
+            if (chunk > len)
+                chunk = len;
+
+            sum = in_csum_block_add(sum,
+                                    in_csum_partial(nb_data(frag) + offset,
+                                                    chunk, 0),
+                                    pos);
+            pos += chunk;
+            len -= chunk;
+            offset = 0;
+        } else {
+            offset -= chunk;
+        }
+
+        frag = (frag == nb) ? nb_shinfo(nb)->frag_list : frag->next;
+    }
+
+    return sum;
+}
+
+/*!
+ * @brief Compute Internet Checksum over the buffer data, including fragments
+ * @param nb Network buffer
+ * @param offset Offset from the buffer data to start
+ * @param len Length of data to calculate
+ * @return 16-bit checksum
+ */
+uint16_t nb_checksum(const struct net_buff_s *nb, uint16_t offset,
+                     uint16_t len) {
+    return in_csum_fold(nb_csum_partial(nb, offset, len, 0));
+}
+
+/*!
+ * @brief Verify TCP/UDP checksum of the received buffer. Buffer data
+ * must point to the transport header. The check is skipped if it is
+ * already done by the device (see \a ip_summed).
+ * @param nb Network buffer
+ * @param saddr Source IP address
+ * @param daddr Destination IP address
+ * @param proto Transport protocol (e.g. IPPROTO_UDP)
+ * @return True if checksum is correct
+ */
+bool nb_csum_tcpudp_ok(const struct net_buff_s *nb, in_addr_t saddr,
+                       in_addr_t daddr, uint8_t proto) {
+    uint16_t len = nb_len(nb);
+
+    if (nb_csum_unnecessary(nb))
+        return true;
+
+    return !csum_tcpudp_magic(saddr, daddr, len, proto,
+                              nb_csum_partial(nb, 0, len, 0));
+}
+
+/*!
+ * @brief Copy the data to the buffer, including fragments,
+ * and compute its partial Internet Checksum in the same pass.
+ * @param nb Network buffer to copy to
+ * @param offset Offset from the buffer data to start
+ * @param from Source data
+ * @param len Length of data
+ * @return 32-bit partial sum of copied data
+ */
+static uint32_t csum_and_copy_to_nb(struct net_buff_s *nb, uint16_t offset,
+                                    const void *from, uint16_t len) {
+    struct net_buff_s *frag = nb;
+    const uint8_t *src = from;
+    uint16_t pos = 0;   // offset of current piece from the start of data
+    uint32_t sum = 0;
+
+    while (frag && len) {
+        uint16_t chunk = nb_headlen(frag);
+
+        if (offset < chunk) {
+            chunk -= offset;
+            if (chunk > len)
+                chunk = len;
+
+            sum = in_csum_block_add(sum,
+                                    csum_partial_copy(src,
+                                                      nb_data(frag) + offset,
+                                                      chunk, 0),
+                                    pos);
+            src += chunk;
+            pos += chunk;
+            len -= chunk;
+            offset = 0;
+        } else {
+            offset -= chunk;
+        }
+
+        frag = (frag == nb) ? nb_shinfo(nb)->frag_list : frag->next;
+    }
+
+    return sum;
+}
+
+/*!
+ * @brief Gather the data of I/O vectors to the buffer, including
+ * fragments, and compute its partial Internet Checksum in the same pass.
+ * @param nb Network buffer to copy to
+ * @param offset Offset from the buffer data to start
+ * @param iov Array of I/O vectors with source data
+ * @param iovlen Number of elements in \p iov
+ * @param sum Sum of previous pieces
+ * @return 32-bit partial sum of copied data
+ */
+uint32_t csum_and_copy_from_iov(struct net_buff_s *nb, uint16_t offset,
+                                const struct iovec *iov, uint8_t iovlen,
+                                uint32_t sum) {
+    uint16_t pos = 0;   // offset of current vector from the start of data
+
+    for (; iovlen; iov++, iovlen--) {
+        sum = in_csum_block_add(sum,
+                                csum_and_copy_to_nb(nb, offset + pos,
+                                                    iov->iov_base,
+                                                    iov->iov_len),
+                                pos);
+        pos += iov->iov_len;
+    }
+
+    return sum;
+}
+
+#ifdef CSUM_SELFTEST
+
+/**
+ * Self-test and benchmark of the optimized routines against the
+ * reference variants. Built only with CSUM_SELFTEST defined.
+ */
+
+#ifndef CSUM_SELFTEST_LEN
+#define CSUM_SELFTEST_LEN 256
+#endif
+
+#if defined(__AVR__)
+/* Reference variants must fit in one period of 16-bit Timer1 */
+_Static_assert(CSUM_SELFTEST_LEN <= 1024, "CSUM_SELFTEST_LEN is too big");
+#define CSUM_BENCH_REPS 1
+#define CSUM_BENCH_RUNS 1
+#else
+#define CSUM_BENCH_REPS 10000
+#define CSUM_BENCH_RUNS 5   // the best of runs is taken
+/* Host without time stamp counter: clock() is scaled by CPU frequency */
+#ifndef CSUM_BENCH_HZ
+#define CSUM_BENCH_HZ 1000000000UL
+#endif
+#endif
+
+static uint8_t csum_test_src[CSUM_SELFTEST_LEN + 3];
+static uint8_t csum_test_dst[2][CSUM_SELFTEST_LEN + 3];
+static volatile uint32_t csum_bench_sink;
+
+/*!
+ * @brief Compare the optimized routines with the reference variants
+ * on random data of random length, alignment and initial sum
+ * @param rounds Number of random cases
+ * @param seed Seed of the random generator
+ * @return 0 if all results match; -1 otherwise
+ */
+int8_t csum_selftest(uint16_t rounds, unsigned int seed) {
+    srand(seed);
+
+    for (uint16_t r = 0; r < rounds; r++) {
+        uint8_t s_off = rand() & 3;
+        uint8_t d_off = rand() & 3;
+        uint16_t len = rand() % (CSUM_SELFTEST_LEN + 1);
+        uint32_t sum = (uint16_t)rand();
+        const uint8_t *src = csum_test_src + s_off;
+
+        for (uint16_t i = 0; i < sizeof(csum_test_src); i++)
+            csum_test_src[i] = rand();
+        memset(csum_test_dst, 0, sizeof(csum_test_dst));
+
+        if (in_csum_fold(in_csum_partial(src, len, sum)) !=
+            in_csum_fold(in_csum_partial_ref(src, len, sum)))
+            goto fail;
+
+        if ((in_csum_fold(csum_partial_copy(src, csum_test_dst[0] + d_off,
+                                            len, sum)) !=
+             in_csum_fold(csum_partial_copy_ref(src, csum_test_dst[1] + d_off,
+                                                len, sum))) ||
+            memcmp(csum_test_dst[0], csum_test_dst[1],
+                   sizeof(csum_test_dst[0])))
+            goto fail;
+        continue;
+
+fail:
+        printf_P(PSTR("csum selftest: mismatch: len %u, src +%u, dst +%u\n"),
+                 len, s_off, d_off);
+        return -1;
+    }
+
+    return 0;
+}
+
+/*!
+ * @brief Run one of the measured routines over the test buffer.
+ * Not inlined, so the routine is not merged into the loop of benchmark
+ * @param fn Routine number; out of range runs nothing (overhead)
+ * @param len Length of data in bytes
+ */
+static __attribute__((noinline)) void csum_bench_call(uint8_t fn,
+                                                     uint16_t len) {
+    switch (fn) {
+        case 0:
+            csum_bench_sink = in_csum_partial_ref(csum_test_src, len, 0);
+            break;
+        case 1:
+            csum_bench_sink = in_csum_partial(csum_test_src, len, 0);
+            break;
+        case 2:
+            csum_bench_sink = csum_partial_copy_ref(csum_test_src,
+                                                    csum_test_dst[0], len, 0);
+            break;
+        case 3:
+            csum_bench_sink = csum_partial_copy(csum_test_src,
+                                                csum_test_dst[0], len, 0);
+            break;
+        default:
+            break;
+    }
+}
+
+#if defined(__AVR__)
+
+/*!
+ * @brief Measure one routine by Timer1 without prescaler
+ * @param fn Routine number
+ * @param len Length of data in bytes
+ * @return CPU cycles
+ */
+static uint32_t csum_bench_run(uint8_t fn, uint16_t len) {
+    uint8_t tccr1a = TCCR1A;
+    uint8_t tccr1b = TCCR1B;
+    uint16_t t;
+
+    TCCR1A = 0;
+    TCCR1B = _BV(CS10);
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        TCNT1 = 0;
+        csum_bench_call(fn, len);
+        t = TCNT1;
+    }
+    TCCR1A = tccr1a;
+    TCCR1B = tccr1b;
+
+    return t;
+}
+
+#else
+
+/*!
+ * @brief Measure one routine by time stamp counter (x86) or by
+ * process time scaled to \a CSUM_BENCH_HZ
+ * @param fn Routine number
+ * @param len Length of data in bytes
+ * @return CPU cycles per call
+ */
+static uint32_t csum_bench_run(uint8_t fn, uint16_t len) {
+#if defined(__x86_64__) || defined(__i386__)
+    uint64_t t = __rdtsc();
+#else
+    clock_t t = clock();
+#endif
+
+    for (uint16_t i = 0; i < CSUM_BENCH_REPS; i++) {
+        csum_bench_call(fn, len);
+        /* buffer may be changed: the sum is not hoisted out of loop */
+        __asm__ __volatile__("" ::: "memory");
+    }
+
+#if defined(__x86_64__) || defined(__i386__)
+    t = __rdtsc() - t;
+
+    return (uint32_t)(t / CSUM_BENCH_REPS);
+#else
+    t = clock() - t;
+
+    return (uint32_t)((double)t * CSUM_BENCH_HZ / CLOCKS_PER_SEC /
+                      CSUM_BENCH_REPS);
+#endif
+}
+
+#endif
+
+/*!
+ * @brief Measure one routine several times
+ * @param fn Routine number
+ * @param len Length of data in bytes
+ * @return The least CPU cycles per call
+ */
+static uint32_t csum_bench_best(uint8_t fn, uint16_t len) {
+    uint32_t best = UINT32_MAX;
+
+    for (uint8_t i = 0; i < CSUM_BENCH_RUNS; i++) {
+        uint32_t t = csum_bench_run(fn, len);
+
+        if (t < best)
+            best = t;
+    }
+
+    return best;
+}
+
+/*!
+ * @brief Print the cost of the reference and optimized routines
+ * in CPU cycles per byte of CSUM_SELFTEST_LEN bytes long buffer
+ */
+void csum_bench(void) {
+    uint32_t base = csum_bench_best(UINT8_MAX, CSUM_SELFTEST_LEN);
+
+    for (uint8_t fn = 0; fn < 4; fn++) {
+        uint32_t t = csum_bench_best(fn, CSUM_SELFTEST_LEN);
+
+        t = (t > base) ? (t - base) : 0;
+        t = t * 100 / CSUM_SELFTEST_LEN;
+        printf_P(PSTR("csum bench: %s%s: %u.%02u cycles/byte\n"),
+                 (fn & 2) ? "copy" : "partial", (fn & 1) ? "" : " (ref)",
+                 (unsigned int)(t / 100), (unsigned int)(t % 100));
+    }
+}
+
+#endif  /* CSUM_SELFTEST */
@@ -2,7 +2,38 @@
 #define NET_CHECKSUM_H
 
 #include <stdint.h>
+#include <stdbool.h>
 
+#include "netinet/in.h"
+
+struct net_buff_s;
+struct iovec;
+
+uint32_t in_csum_partial_ref(const void *buf, uint16_t count, uint32_t sum);
+uint32_t in_csum_partial(const void *buf, uint16_t count, uint32_t sum);
+uint32_t csum_partial_copy(const void *src, void *dst, uint16_t count,
+                           uint32_t sum);
+uint16_t in_csum_fold(uint32_t sum);
 uint16_t in_checksum(void *buf, uint16_t len);
+uint32_t csum_tcpudp_nofold(in_addr_t saddr, in_addr_t daddr,
+                            uint16_t len, uint8_t proto, uint32_t sum);
+uint16_t csum_tcpudp_magic(in_addr_t saddr, in_addr_t daddr,
+                           uint16_t len, uint8_t proto, uint32_t sum);
+void csum_replace2(uint16_t *chks, uint16_t from, uint16_t to);
+void csum_replace4(uint16_t *chks, uint32_t from, uint32_t to);
+uint32_t nb_csum_partial(const struct net_buff_s *nb, uint16_t offset,
+                         uint16_t len, uint32_t sum);
+uint16_t nb_checksum(const struct net_buff_s *nb, uint16_t offset,
+                     uint16_t len);
+bool nb_csum_tcpudp_ok(const struct net_buff_s *nb, in_addr_t saddr,
+                       in_addr_t daddr, uint8_t proto);
+uint32_t csum_and_copy_from_iov(struct net_buff_s *nb, uint16_t offset,
+                                const struct iovec *iov, uint8_t iovlen,
+                                uint32_t sum);
+
+#ifdef CSUM_SELFTEST
+int8_t csum_selftest(uint16_t rounds, unsigned int seed);
+void csum_bench(void);
+#endif
 
 #endif  /* !NET_CHECKSUM_H */
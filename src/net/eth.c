@@ -11,7 +11,7 @@
 #include "arpa/inet.h"
 
 /*!
- * @brief Create the Ethernet Header
+ * @brief Create the Ethernet Header in the headroom of buffer
  * @param net_buff Buffer to create header
  * @param type Ethernet type
  * @param mac_d Destination MAC address
@@ -23,8 +23,10 @@ int8_t eth_header_create(struct net_buff_s *net_buff, struct net_dev_s *net_dev,
                          int16_t len) {
     struct eth_header_s *header_p;
 
-    net_buff->pkt_len += ETH_HDR_LEN;
-    header_p = (void *)net_buff->head + net_buff->mac_hdr_offset;
+    header_p = push_net_buff(net_buff, ETH_HDR_LEN);
+    if (!header_p)
+        return -1;
+    nb_reset_mac_hdr(net_buff);
 
     if (type <= 1500)
         header_p->eth_type = htons(len);
@@ -42,8 +44,28 @@ int8_t eth_header_create(struct net_buff_s *net_buff, struct net_dev_s *net_dev,
     return 0;
 }
 
+/*!
+ * @brief Build the Ethernet Header template
+ * @param net_dev Network device (source MAC)
+ * @param type Ethernet type
+ * @param mac_d Destination MAC address
+ * @param hh Buffer for header (ETH_HDR_LEN bytes)
+ * @return 0 if success
+ */
+int8_t eth_header_cache(const struct net_dev_s *net_dev, uint16_t type,
+                        const void *mac_d, uint8_t *hh) {
+    struct eth_header_s *header_p = (struct eth_header_s *)hh;
+
+    memcpy(header_p->mac_dest, mac_d, ETH_MAC_LEN);
+    memcpy(header_p->mac_src, net_dev->dev_addr, ETH_MAC_LEN);
+    header_p->eth_type = htons(type);
+
+    return 0;
+}
+
 static const struct header_ops_s eth_header_ops PROGMEM = {
-    .create = eth_header_create
+    .create = eth_header_create,
+    .cache = eth_header_cache,
 };
 
 /*!
@@ -52,6 +74,8 @@ static const struct header_ops_s eth_header_ops PROGMEM = {
  */
 void ether_setup(struct net_dev_s *net_dev) {
     net_dev->header_ops = &eth_header_ops;
+    net_dev->hard_hdr_len = ETH_HDR_LEN;
+    net_dev->mtu = ETH_DATA_LEN;
     net_dev->flags.rx_mode = RX_RT_BROADCAST | RX_RT_MULTICAST;
 
     memset(net_dev->broadcast, 0xFF, ETH_MAC_LEN);
@@ -78,7 +102,8 @@ static bool mac_addr_equal(const uint8_t *addr1, const uint8_t *addr2) {
 }
 
 /*!
- * @brief Determine the packet protocol and construct
+ * @brief Determine the packet protocol and construct.
+ * Ethernet header is pulled, so data points to the network header.
  * @param net_buff Receiving socket data
  * @param net_dev Receiving net device
  * @return Packet Protocol ID
@@ -87,13 +112,11 @@ uint16_t eth_type_proto(struct net_buff_s *net_buff, struct net_dev_s *net_dev)
     struct eth_header_s *ehdr;
 
     net_buff->net_dev = net_dev;
-    net_buff->mac_hdr_offset = net_buff->data - net_buff->head;
-    ehdr = (struct eth_header_s *)net_buff->data;
-    
-    // if (ETH_HDR_LEN <= net_buff->pkt_len) {
-    //     net_buff->pkt_len -= ETH_HDR_LEN;
-    //     net_buff->data += ETH_HDR_LEN;
-    // }
+    nb_reset_mac_hdr(net_buff);
+    ehdr = nb_mac_hdr(net_buff);
+
+    pull_net_buff(net_buff, ETH_HDR_LEN);
+    nb_reset_network_hdr(net_buff);
 
     if (!mac_addr_equal(net_dev->dev_addr, ehdr->mac_dest)) {
         if (ehdr->mac_dest[0] & 0x01) {
@@ -8,6 +8,9 @@
 
 #define ETH_MAC_LEN 6U
 #define ETH_HDR_LEN 14U
+#define ETH_DATA_LEN 1500U  // Max. payload length (MTU)
+#define ETH_FRAME_LEN 1514U // Max. frame length without FCS
+#define ETH_FCS_LEN 4U      // Frame Check Sequence (CRC) length
 
 /* Ether Types */
 #define ETH_P_IP        0x0800  // Internet Protocol
@@ -30,6 +33,8 @@ struct eth_frame_s {
 int8_t eth_header_create(struct net_buff_s *net_buff, struct net_dev_s *net_dev,
                          int16_t type, const void *mac_d, const void *mac_s,
                          int16_t len);
+int8_t eth_header_cache(const struct net_dev_s *net_dev, uint16_t type,
+                        const void *mac_d, uint8_t *hh);
 void ether_setup(struct net_dev_s *net_dev);
 struct net_dev_s *eth_dev_alloc(uint8_t size);
 uint16_t eth_type_proto(struct net_buff_s *net_buff, struct net_dev_s *net_dev);
@@ -2,54 +2,134 @@
 #include <avr/interrupt.h>
 #include <avr/pgmspace.h>
 
+#include <stdbool.h>
+
 #include "net/net.h"
 #include "net/net_dev.h"
 #include "net/ether.h"
 #include "net/interrupt.h"
 
-struct nd_irq_hdlr_s {
-    struct net_dev_s *net_dev;
-};
+/*!
+ * @brief Interrupt handler of the device. It needs to be called from
+ * the ISR of the device interrupt line, so each device has its own.
+ * Received packets are only queued here, the protocol processing is done
+ * by \a net_rx_poll() from the main loop.
+ * E.g. gateway with two controllers:
+ISR(INT0_vect) {
+    net_dev_irq(eth0);
+}
+
+ISR(INT1_vect) {
+    net_dev_irq(eth1);
+}
+
+int main(void) {
+    ...
+    while (1) {
+        net_rx_poll(4);
+        ...
+    }
+}
+ * @param net_dev Network device added by \a irq_hdlr_add()
+ */
+void net_dev_irq(struct net_dev_s *net_dev) {
+    void (*irq_hdlr_f)(struct net_dev_s *);
+
+    if (!net_dev->irq_hdlr)
+        return;
+
+    /* polling mode: mask the device IRQ and schedule the polling */
+    if (pgm_read_ptr(&net_dev->netdev_ops->poll)) {
+        irq_hdlr_f = pgm_read_ptr(&net_dev->netdev_ops->irq_disable);
+        if (irq_hdlr_f)
+            irq_hdlr_f(net_dev);
+        net_dev->poll_sched = true;
+        return;
+    }
 
-static struct nd_irq_hdlr_s nd_irq_hdlr = {
-    .net_dev = NULL
-};
+    irq_hdlr_f = pgm_read_ptr(&net_dev->netdev_ops->irq_handler);
+    irq_hdlr_f(net_dev);
+}
 
 /*!
- * @brief Basic interrupt handler. It needs to be called from the ISR body.
+ * @brief Basic interrupt handler: serves all the devices added by
+ * \a irq_hdlr_add(). Used when the devices share one interrupt line
+ * (or there is only one device). It needs to be called from the ISR body.
  * E.g.:
 ISR(INT0_vect) {
     net_dev_irq_handler();
 }
  */
 inline void net_dev_irq_handler(void) {
-    void (*irq_hdlr_f)(struct net_dev_s *);
+    struct net_dev_s *ndev;
+
+    net_dev_for_each(ndev) {
+        net_dev_irq(ndev);
+    }
+}
+
+/*!
+ * @brief Poll the devices scheduled by interrupt. The device IRQ
+ * is unmasked only when the device is drained. Also feeds
+ * the transmit queues of all the devices.
+ * @param budget Max. number of frames to process
+ * @return Number of processed frames
+ */
+uint8_t net_dev_poll(uint8_t budget) {
+    struct net_dev_s *ndev;
+    uint8_t (*poll_f)(struct net_dev_s *, uint8_t);
+    void (*irq_enable_f)(struct net_dev_s *);
+    uint8_t done = 0;
+
+    net_dev_for_each(ndev) {
+        uint8_t left = budget - done;
+        uint8_t n;
+
+        /* feed the controller if the tx complete was missed */
+        netdev_tx_run(ndev);
+
+        if (!ndev->poll_sched || !left)
+            continue;
 
-    if (nd_irq_hdlr.net_dev) {
-        irq_hdlr_f = pgm_read_ptr(&nd_irq_hdlr.net_dev->netdev_ops->irq_handler);
-        irq_hdlr_f(nd_irq_hdlr.net_dev);
+        poll_f = pgm_read_ptr(&ndev->netdev_ops->poll);
+        n = poll_f(ndev, left);
+        done += n;
+
+        if (n < left) {
+            ndev->poll_sched = false;
+            irq_enable_f = pgm_read_ptr(&ndev->netdev_ops->irq_enable);
+            if (irq_enable_f)
+                irq_enable_f(ndev);
+        }
     }
+
+    return done;
 }
 
 /*!
- * @brief Add a handler for interrupt
- * @param net_dev Network device with \a irq_handler func
+ * @brief Add a handler for interrupt of the device
+ * @param net_dev Registered network device with \a irq_handler
+ *                or \a poll func
  * @return 0 if success
  */
 int8_t irq_hdlr_add(struct net_dev_s *net_dev) {
     if (!net_dev ||
         !net_dev->netdev_ops ||
-        !pgm_read_ptr(&net_dev->netdev_ops->irq_handler))
+        (!pgm_read_ptr(&net_dev->netdev_ops->irq_handler) &&
+         !pgm_read_ptr(&net_dev->netdev_ops->poll)))
         return -1;
 
-    nd_irq_hdlr.net_dev = net_dev;
+    net_dev->poll_sched = false;
+    net_dev->irq_hdlr = true;
 
     return 0;
 }
 
 /*!
- * @brief Delete a handler for interrupt
+ * @brief Delete a handler for interrupt of the device
+ * @param net_dev Network device
  */
-void irq_hdlr_del(void) {
-    nd_irq_hdlr.net_dev = NULL;
-}
\ No newline at end of file
+void irq_hdlr_del(struct net_dev_s *net_dev) {
+    net_dev->irq_hdlr = false;
+    net_dev->poll_sched = false;
+}
@@ -8,8 +8,10 @@
 
 typedef void (*irq_handler_t)(struct net_dev_s *net_dev);
 
+void net_dev_irq(struct net_dev_s *net_dev);
 void net_dev_irq_handler(void);
+uint8_t net_dev_poll(uint8_t budget);
 int8_t irq_hdlr_add(struct net_dev_s *net_dev);
-void irq_hdlr_del(void);
+void irq_hdlr_del(struct net_dev_s *net_dev);
 
 #endif  /* !NET_INTERRUPT_H */
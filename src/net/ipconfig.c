@@ -16,12 +16,11 @@
 #include "netinet/in.h"
 #include "netinet/ip.h"
 #include "netinet/udp.h"
+#include "netinet/route.h"
 
-in_addr_t my_ip = htonl(INADDR_NONE);       // My IP Address
-in_addr_t net_mask = htonl(INADDR_NONE);    // Netmask for local subnet
-in_addr_t gateway = htonl(INADDR_NONE);     // Gateway IP Address
 in_addr_t dns_serv = htonl(INADDR_NONE);    // DNS server IP Address
 
+struct net_dev_s *dhcp_dev = NULL;  // device being configured
 static in_addr_t serv_addr = htonl(INADDR_NONE);    // Boot server IP Address
 static uint32_t xid = 0;
 
@@ -65,6 +64,13 @@ const uint8_t host_name[] PROGMEM = "bosduino";
 
 #define DHCP_OPT_END 0xFF   /* Endmark */
 
+#define DHCP_RETRIES 6  /* Number of attempts */
+#define DHCP_TIMEOUT 4  /* Time to wait for reply, sec */
+/* Polls without a tick after which the network time is considered
+ * not running: one poll takes more than a CPU cycle, so it is
+ * longer than the tick */
+#define DHCP_TICK_POLLS ((uint32_t)F_CPU / NET_HZ)
+
 struct dhcp_pkt_s {
     struct ip_hdr_s iph;    // IPv4 header
     struct udp_hdr_s udph;  // UDP header
@@ -94,23 +100,24 @@ static void xid_gen(void) {
 }
 
 /*!
- * @brief Receive DHCP reply
+ * @brief Receive DHCP reply. IP packets received on \a dhcp_dev are
+ * passed here by \a ip_recv()
  * @return 0 if succes
  */
-static int8_t dhcp_recv(struct net_buff_s *net_buff) {
+int8_t dhcp_recv(struct net_buff_s *net_buff) {
     struct dhcp_pkt_s *pkt;
     struct ip_hdr_s *iph;
     int16_t data_len, opt_len;
     struct net_dev_s *net_dev = net_buff->net_dev;
 
-    if (net_dev != curr_net_dev)
+    if (net_dev != dhcp_dev)
         goto out;
 
     // check what packet is not for us
     if (net_buff->flags.pkt_type == PKT_OTHERHOST)
         goto out;
     
-    pkt = (struct dhcp_pkt_s *)(net_buff->head + net_buff->network_hdr_offset);
+    pkt = nb_network_hdr(net_buff);
     iph = &pkt->iph;
 
     // check receive protocol
@@ -123,7 +130,7 @@ static int8_t dhcp_recv(struct net_buff_s *net_buff) {
         goto out;
     
     // check checksum
-    if (in_checksum(iph, iph->ihl * 4))
+    if (!nb_csum_unnecessary(net_buff) && in_checksum(iph, iph->ihl * 4))
         goto out;
     
     data_len = pkt->udph.len - sizeof(struct udp_hdr_s);
@@ -177,9 +184,9 @@ static int8_t dhcp_recv(struct net_buff_s *net_buff) {
 
         switch (msg_type) {
             case DHCP_OFFER:
-                if (my_ip != htonl(INADDR_NONE))
+                if (net_dev->ip_addr != htonl(INADDR_NONE))
                     goto out;
-                my_ip = pkt->yiaddr;
+                net_dev->ip_addr = pkt->yiaddr;
                 serv_addr = srv_id;
                 if ((serv_addr != htonl(INADDR_NONE)) &&
                     (serv_addr != pkt->siaddr))
@@ -193,7 +200,7 @@ static int8_t dhcp_recv(struct net_buff_s *net_buff) {
                 break;
 
             default:    // failed
-                my_ip = htonl(INADDR_NONE);
+                net_dev->ip_addr = htonl(INADDR_NONE);
                 serv_addr = htonl(INADDR_NONE);
                 goto out;
         }
@@ -212,11 +219,11 @@ static int8_t dhcp_recv(struct net_buff_s *net_buff) {
 
             switch (*opt++) {
                 case DHCP_OPT_SMASK:
-                    memcpy(&net_mask, opt + 1, 4);
+                    memcpy(&net_dev->ip_mask, opt + 1, 4);
                     break;
                 
                 case DHCP_OPT_ROUTER:
-                    memcpy(&gateway, opt + 1, 4);
+                    memcpy(&net_dev->ip_gw, opt + 1, 4);
                     break;
                 
                 case DHCP_OPT_DNS:
@@ -233,11 +240,11 @@ static int8_t dhcp_recv(struct net_buff_s *net_buff) {
         }
     }
 
-    my_ip = pkt->yiaddr;
+    net_dev->ip_addr = pkt->yiaddr;
     if (serv_addr == htonl(INADDR_NONE))
         serv_addr = pkt->siaddr;
-    if ((gateway == htonl(INADDR_NONE)) && (pkt->giaddr))
-        gateway = pkt->giaddr;
+    if ((net_dev->ip_gw == htonl(INADDR_NONE)) && (pkt->giaddr))
+        net_dev->ip_gw = pkt->giaddr;
     got_reply = true;
 
 out:
@@ -269,7 +276,7 @@ static void dhcp_options_init(uint8_t *options) {
 
         *opt++ = DHCP_OPT_REQIP;
         *opt++ = 0x04;  // size of field
-        memcpy(opt, &my_ip, 4);
+        memcpy(opt, &dhcp_dev->ip_addr, 4);
         opt += 4;
     }
 
@@ -298,20 +305,20 @@ static void dhcp_send_request(void) {
     struct net_buff_s *net_buff;
     struct dhcp_pkt_s *pkt;
 
-    net_buff = net_buff_alloc(sizeof(struct dhcp_pkt_s) + ETH_HDR_LEN);
+    net_buff = net_buff_alloc(sizeof(struct dhcp_pkt_s) +
+                              dhcp_dev->hard_hdr_len);
     if (!net_buff) {
         printf_P(PSTR("\nError: IP config: dhcp_send_request: net_buff_alloc: not enough memory\n"));
         return;
     }
 
-    net_buff->data += ETH_HDR_LEN;
-    net_buff->tail += ETH_HDR_LEN;
+    reserve_net_buff(net_buff, dhcp_dev->hard_hdr_len);
 
     pkt = put_net_buff(net_buff, sizeof(struct dhcp_pkt_s));
     memset(pkt, 0, sizeof(struct dhcp_pkt_s));
 
     /* create IP header */
-    net_buff->network_hdr_offset = net_buff->data - net_buff->head;
+    nb_reset_network_hdr(net_buff);
     
     pkt->iph.version = 4;
     pkt->iph.ihl = 5;
@@ -320,28 +327,24 @@ static void dhcp_send_request(void) {
     pkt->iph.ttl = 64;
     pkt->iph.protocol = IPPROTO_UDP;
     pkt->iph.ip_dst = htonl(INADDR_BROADCAST);
-    pkt->iph.hdr_chks = in_checksum(&pkt->iph, pkt->iph.ihl * 4);
+    if (!(dhcp_dev->features & NETDEV_F_TXCSUM))
+        pkt->iph.hdr_chks = in_checksum(&pkt->iph, pkt->iph.ihl * 4);
     /** \c tos, \c id and \c ip_src is already zero */
 
-    net_buff->data += sizeof(struct ip_hdr_s);
-    net_buff->tail += sizeof(struct ip_hdr_s);
-
     /* create UDP header */
-    net_buff->transport_hdr_offset = net_buff->data - net_buff->head;
+    net_buff->transport_hdr_offset = net_buff->network_hdr_offset +
+                                     sizeof(struct ip_hdr_s);
 
     pkt->udph.port_src = htons(68);
     pkt->udph.port_dst = htons(67);
     pkt->udph.len = htons(sizeof(struct dhcp_pkt_s) - sizeof(struct ip_hdr_s));
     // UDP checksum is not calculated - this is allowed in the BOOTP RFC
 
-    net_buff->data += sizeof(struct udp_hdr_s);
-    net_buff->tail += sizeof(struct udp_hdr_s);
-
     /* create DHCP header */
     pkt->op = BOOTP_REQUEST;
     pkt->htype = 0x01;  // Ethernet
     pkt->hlen = ETH_MAC_LEN;
-    memcpy(pkt->chaddr, curr_net_dev->dev_addr, ETH_MAC_LEN);
+    memcpy(pkt->chaddr, dhcp_dev->dev_addr, ETH_MAC_LEN);
     pkt->xid = xid;
     /** \c yiaddr and \c siaddr is alrady zero. */
 
@@ -349,12 +352,12 @@ static void dhcp_send_request(void) {
     dhcp_options_init(pkt->options);
 
     /* create Ethernet Header */
-    net_buff->net_dev = curr_net_dev;
+    net_buff->net_dev = dhcp_dev;
     net_buff->protocol = htons(ETH_P_IP);
 
-    if (netdev_hdr_create(net_buff, curr_net_dev, ntohs(net_buff->protocol),
-                          curr_net_dev->broadcast, curr_net_dev->dev_addr,
-                          net_buff->pkt_len)) {
+    if (netdev_hdr_create(net_buff, dhcp_dev, ntohs(net_buff->protocol),
+                          dhcp_dev->broadcast, dhcp_dev->dev_addr,
+                          nb_len(net_buff))) {
         free_net_buff(net_buff);
         printf_P(PSTR("Error: IP config: device header create error\n"));
         return;
@@ -366,25 +369,50 @@ static void dhcp_send_request(void) {
 
 /*!
  * @brief DHCP configuration
+ * @param net_dev Device to configure
  * @return 0 if success
  */
-static int8_t dhcp(void) {
-    int8_t retries = 6;
-    int32_t t_out;
-
+static int8_t dhcp(struct net_dev_s *net_dev) {
+    int8_t retries = DHCP_RETRIES;
+    uint32_t t_out, now, stall;
+    bool no_tick = false;
+    proto_hdlr_t ip_hdlr = pkt_hdlr_get(ETH_P_IP);
+
+    dhcp_dev = net_dev;
+    serv_addr = htonl(INADDR_NONE);
+    got_reply = false;
     xid_gen();
-    pkt_hdlr_add(ETH_P_IP, dhcp_recv);
+    /* ip_recv() passes the packets of dhcp_dev here, so other devices
+     * keep receiving IP. Before network_init() there is no IP handler,
+     * so the replies are received directly */
+    if (!ip_hdlr)
+        pkt_hdlr_add(ETH_P_IP, dhcp_recv);
 
     printf_P(PSTR("Sending DHCP request..."));
 
-    /* 6 attempt with timeout ~4 sec */
+    /* timeout is measured by the network time, so it does not depend
+     * on the cost of polling; net_tick() must be running */
     while (true) {
         dhcp_send_request();
 
-        t_out = F_CPU / 4;
-        while (t_out && !got_reply)
-            t_out--;
-        
+        now = net_jiffies();
+        t_out = now + DHCP_TIMEOUT * NET_HZ;
+        stall = 0;
+        while (!got_reply && !net_time_after(now, t_out)) {
+            net_rx_poll(1);
+            if (net_jiffies() != now) {
+                now = net_jiffies();
+                stall = 0;
+            } else if (++stall > DHCP_TICK_POLLS) {
+                no_tick = true;
+                break;
+            }
+        }
+
+        if (no_tick) {
+            printf_P(PSTR("\nError: IP config: network time is not running\n"));
+            break;
+        }
         if (got_reply) {
             if (dhcp_msg_type == DHCP_ACK) {
                 printf_P(PSTR(" OK!\n"));
@@ -404,10 +432,12 @@ static int8_t dhcp(void) {
         putchar('.');
     }
 
-    pkt_hdlr_del(ETH_P_IP);
+    if (!ip_hdlr)
+        pkt_hdlr_del(ETH_P_IP);
+    dhcp_dev = NULL;
 
     if (!got_reply) {
-        my_ip = htonl(INADDR_NONE);
+        net_dev->ip_addr = htonl(INADDR_NONE);
         return -1;
     }
 
@@ -416,14 +446,16 @@ static int8_t dhcp(void) {
 
 /*!
  * @brief Auto configuring the IP address with DHCP
- * for the currently active network device
+ * for the network device. DHCP timeouts are measured by the network
+ * time, so \a net_tick() must be running
+ * @param net_dev Registered network device
  * @return 0 if success; errno if error
  */
-int8_t ip_auto_config(void) {
+int8_t ip_auto_config(struct net_dev_s *net_dev) {
     int8_t err = 0;
     uint8_t *ptr;
 
-    if (!curr_net_dev) {
+    if (!net_dev) {
         // no device - error
         // ENODEV
         printf_P(PSTR("Error: IP Config: No Network Device\n"));
@@ -432,30 +464,29 @@ int8_t ip_auto_config(void) {
 
     // opening net device...
     // in this operation, if successful, the up_state flag is set
-    err = netdev_open(curr_net_dev);
+    err = netdev_open(net_dev);
     if (err) {
         printf_P(PSTR("Error: IP Config: Failed to open\n"));
         return err;
     }
 
-    if (my_ip == htonl(INADDR_NONE)) {
+    if (net_dev->ip_addr == htonl(INADDR_NONE)) {
         // loop until link status is UP
-        while (!net_dev_link_is_up(curr_net_dev)) {
+        while (!net_dev_link_is_up(net_dev)) {
             /** BUG: for some reason does not work without delay */
             _delay_ms(0);
         }
 
-        err = dhcp();
+        err = dhcp(net_dev);
         if (err) {
-            netdev_close(curr_net_dev);
-            curr_net_dev = NULL;
+            netdev_close(net_dev);
             printf_P(PSTR("Error: IP config: Autoconfig of network failed\n"));
             return err;
         }
     }
 
-    if (net_mask == htonl(INADDR_NONE)) {
-        err = inet_class_determine(&my_ip, &net_mask);
+    if (net_dev->ip_mask == htonl(INADDR_NONE)) {
+        err = inet_class_determine(&net_dev->ip_addr, &net_dev->ip_mask);
         if ((err < 0) || (err >= IN_CLASS_D)) {
             printf_P(PSTR("Error: IP config: This IP address is reserved and "
                           "cannot be assigned to a network or host.\n"));
@@ -465,12 +496,18 @@ int8_t ip_auto_config(void) {
         err = 0;
     }
 
+    err = route_dev_up(net_dev);
+    if (err) {
+        printf_P(PSTR("Error: IP config: Failed to add routes\n"));
+        return err;
+    }
+
     printf_P(PSTR("IP config: Success\n"));
-    ptr = (void *)&my_ip;
+    ptr = (void *)&net_dev->ip_addr;
     printf_P(PSTR("ip: %u.%u.%u.%u\n"), ptr[0], ptr[1], ptr[2], ptr[3]);
-    ptr = (void *)&net_mask;
+    ptr = (void *)&net_dev->ip_mask;
     printf_P(PSTR("Mask: %u.%u.%u.%u\n"), ptr[0], ptr[1], ptr[2], ptr[3]);
-    ptr = (void *)&gateway;
+    ptr = (void *)&net_dev->ip_gw;
     printf_P(PSTR("Gateway: %u.%u.%u.%u\n"), ptr[0], ptr[1], ptr[2], ptr[3]);
     ptr = (void *)&dns_serv;
     printf_P(PSTR("DNS: %u.%u.%u.%u\n\n"), ptr[0], ptr[1], ptr[2], ptr[3]);
@@ -480,26 +517,32 @@ int8_t ip_auto_config(void) {
 
 /*!
  * @brief Configuration the IP address (or autoconfig with DHCP)
- *  for the currently network device.
+ *  for the network device.
+ * @param net_dev Registered network device
  * @param ip IP-address to set, string (might be \a NULL)
  * @param nm Net Mask to set (might be \a NULL)
  * @param gw Gateway address (might be \a NULL)
  * @param dns DNS address (might be \a NULL)
  * @return 0 if success
  */
-int8_t ip_config(const char *ip, const char *nm,
+int8_t ip_config(struct net_dev_s *net_dev,
+                 const char *ip, const char *nm,
                  const char *gw, const char *dns) {
+    if (!net_dev)
+        // ENODEV
+        return -1;
+
     if (ip && (ip[0] != '\0'))
-        my_ip = inet_addr(ip);
+        net_dev->ip_addr = inet_addr(ip);
 
     if (nm && (nm[0] != '\0'))
-        net_mask = inet_addr(nm);
+        net_dev->ip_mask = inet_addr(nm);
 
     if (gw && (gw[0] != '\0'))
-        gateway = inet_addr(gw);
+        net_dev->ip_gw = inet_addr(gw);
 
     if (dns && (dns[0] != '\0'))
         dns_serv = inet_addr(dns);
 
-    return ip_auto_config();
+    return ip_auto_config(net_dev);
 }
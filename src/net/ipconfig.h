@@ -5,16 +5,18 @@
 
 #include <stdint.h>
 
+#include "net/net_dev.h"
 #include "netinet/in.h"
 
-extern in_addr_t my_ip;
-extern in_addr_t net_mask;
-extern in_addr_t gateway;
 extern in_addr_t dns_serv;
 extern const uint8_t host_name[] PROGMEM;
+extern struct net_dev_s *dhcp_dev;
 
-int8_t ip_auto_config(void);
-int8_t ip_config(const char *ip, const char *nm,
+int8_t dhcp_recv(struct net_buff_s *net_buff);
+
+int8_t ip_auto_config(struct net_dev_s *net_dev);
+int8_t ip_config(struct net_dev_s *net_dev,
+                 const char *ip, const char *nm,
                  const char *gw, const char *dns);
 
 #endif  /* !NET_IPCONFIG_H */
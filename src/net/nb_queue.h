@@ -5,6 +5,13 @@
 
 #include "net/net.h"
 
+/*!
+ * @brief Queue of network buffers. Buffers are linked through \a next,
+ * the last one points to the queue itself.
+ * @param next First buffer in queue (must be the first member)
+ * @param prev Last buffer in queue
+ * @param q_len Queue length
+ */
 struct nb_queue_s {
     struct net_buff_s *next,
                       *prev;
@@ -1,54 +1,349 @@
 #include <avr/io.h>
 #include <avr/pgmspace.h>
+#include <util/atomic.h>
 
 #include <stdint.h>
+#include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "net/net.h"
 #include "net/net_dev.h"
 #include "net/ether.h"
+#include "net/pkt_handler.h"
+#include "net/socket.h"
 #include "netinet/arp.h"
 #include "netinet/ip.h"
+#include "netinet/route.h"
 #include "netinet/tcp.h"
 #include "netinet/udp.h"
 #include "netinet/icmp.h"
 
 extern void inet_init(void);
 
+/*!
+ * @brief Free data slab. While slab is free, its first bytes
+ * are used as link to the next free slab.
+ */
+struct nb_free_slab_s {
+    struct nb_free_slab_s *next;
+};
+
+/*!
+ * @brief Data slab of full frame size
+ */
+union nb_slab_u {
+    struct nb_free_slab_s link;
+    uint8_t data[NB_SLAB_SIZE + sizeof(struct nb_shinfo_s)];
+};
+
+/*!
+ * @brief Small data slab for short frames
+ */
+union nb_small_u {
+    struct nb_free_slab_s link;
+    uint8_t data[NB_SMALL_SIZE + sizeof(struct nb_shinfo_s)];
+};
+
+/*!
+ * @brief Class of data slabs of one size
+ * @param pool First slab
+ * @param size Size of slab, including the shared info
+ * @param num Number of slabs
+ * @param free List of released slabs
+ * @param fresh Index of first never used slab
+ */
+struct nb_slab_class_s {
+    uint8_t *pool;
+    uint16_t size;
+    uint8_t num;
+    struct nb_free_slab_s *free;
+    uint8_t fresh;
+};
+
+_Static_assert((NB_POOL_SIZE <= 255) && (NB_SLAB_NUM + NB_SMALL_NUM <= 255),
+               "NB_POOL_SIZE and NB_SLAB_NUM + NB_SMALL_NUM must not be "
+               "more than 255");
+_Static_assert((NB_SMALL_NUM > 0) && (NB_SMALL_SIZE < NB_SLAB_SIZE),
+               "small slabs must be present and less than NB_SLAB_SIZE");
+
+/* Buffers held for long (socket queue, packets waiting for ARP) and the
+ * receive ring must not be able to take all the slabs, see nb_pool_low() */
+_Static_assert(UDP_RX_QUEUE_LEN + ARP_QUEUE_LEN + NB_POOL_RESERVE <=
+               NB_SLAB_NUM + NB_SMALL_NUM,
+               "UDP_RX_QUEUE_LEN and ARP_QUEUE_LEN do not fit the slab pool");
+_Static_assert(NET_RX_RING_SIZE + NB_POOL_RESERVE <= NB_SLAB_NUM + NB_SMALL_NUM,
+               "NET_RX_RING_SIZE does not fit the slab pool");
+_Static_assert(NET_RX_RING_SIZE + NB_POOL_RESERVE < NB_POOL_SIZE,
+               "NET_RX_RING_SIZE does not fit the descriptor pool");
+
+static struct net_buff_s nb_desc_pool[NB_POOL_SIZE];
+static union nb_slab_u nb_slab_pool[NB_SLAB_NUM];
+static union nb_small_u nb_small_pool[NB_SMALL_NUM];
+
+#if defined(__AVR__) && (RAMEND < 0x1000)
+/* Static tables of the stack must leave room on 2 KB parts */
+_Static_assert(sizeof(nb_desc_pool) + sizeof(nb_slab_pool) +
+               sizeof(nb_small_pool) +
+               ARP_TBL_SIZE * sizeof(struct arp_tbl_entry_s) + ARP_HASH_SIZE +
+               RT_TBL_SIZE * sizeof(struct rtable_s) +
+               SK_HTABLE_SIZE * sizeof(struct socket *) <= NET_STATIC_RAM_MAX,
+               "network tables exceed NET_STATIC_RAM_MAX");
+#endif
+
+/* The pool needs no initialization, so buffers may be allocated before
+ * network_init() (e.g. by DHCP). Lists hold the released items only;
+ * items after the \a fresh index were never used and are free too */
+static struct net_buff_s *nb_desc_free = NULL;  // list of released descriptors
+static uint8_t nb_desc_fresh = 0;   // index of first never used descriptor
+static uint8_t nb_desc_avail = NB_POOL_SIZE;    // number of free descriptors
+static uint8_t nb_slab_avail = NB_SLAB_NUM + NB_SMALL_NUM;  // free slabs of both classes
+
+static struct nb_slab_class_s nb_slab_class = {
+    .pool = (uint8_t *)nb_slab_pool,
+    .size = sizeof(union nb_slab_u),
+    .num = NB_SLAB_NUM,
+};
+
+/* heap blocks released in interrupt, see nb_heap_put() */
+static struct nb_free_slab_s *nb_heap_defer = NULL;
+
+static struct nb_slab_class_s nb_small_class = {
+    .pool = (uint8_t *)nb_small_pool,
+    .size = sizeof(union nb_small_u),
+    .num = NB_SMALL_NUM,
+};
+
+struct nb_pool_stats_s nb_pool_stats;
+
+static volatile uint32_t jiffies = 0;   // ticks since start
+
+/*!
+ * @brief Check that the data was taken from the slab class
+ * @param cls Slab class
+ * @param data Pointer to data
+ * @return True if \p data is slab of \p cls
+ */
+static inline bool nb_is_slab(const struct nb_slab_class_s *cls,
+                              const void *data) {
+    return (((const uint8_t *)data >= cls->pool) &&
+            ((const uint8_t *)data < cls->pool + cls->size * cls->num));
+}
+
+/*!
+ * @brief Get a free descriptor from the pool
+ * @return Pointer to descriptor or \a NULL if pool is exhausted
+ */
+static struct net_buff_s *nb_desc_get(void) {
+    struct net_buff_s *buff;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        buff = nb_desc_free;
+        if (buff)
+            nb_desc_free = buff->next;
+        else if (nb_desc_fresh < NB_POOL_SIZE)
+            buff = &nb_desc_pool[nb_desc_fresh++];
+
+        if (buff)
+            nb_desc_avail--;
+        else
+            nb_pool_stats.desc_exhausted++;
+    }
+
+    return buff;
+}
+
+/*!
+ * @brief Return a descriptor to the pool
+ * @param buff Descriptor to return
+ */
+static void nb_desc_put(struct net_buff_s *buff) {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        buff->next = nb_desc_free;
+        nb_desc_free = buff;
+        nb_desc_avail++;
+    }
+}
+
+/*!
+ * @brief Get a free slab of the class. Must be called with
+ * interrupts disabled.
+ * @param cls Slab class
+ * @return Pointer to slab or \a NULL if class is exhausted
+ */
+static uint8_t *nb_slab_get(struct nb_slab_class_s *cls) {
+    struct nb_free_slab_s *slab = cls->free;
+
+    if (slab)
+        cls->free = slab->next;
+    else if (cls->fresh < cls->num)
+        slab = (void *)(cls->pool + cls->size * cls->fresh++);
+    else
+        return NULL;
+
+    nb_slab_avail--;
+
+    return (uint8_t *)slab;
+}
+
+/*!
+ * @brief Get a data block. Short requests are served from the small
+ * slabs (or full slabs when they are exhausted), requests that fit into
+ * the full slab - from the full slabs, oversize requests - from the heap.
+ * Room for the shared info is added after the data.
+ * @param size Size of data
+ * @param heap Oversize request may be served from the heap. Must be
+ *             \a false in interrupt context: the heap is not reentrant
+ * @return Pointer to data or \a NULL if no memory
+ */
+static uint8_t *nb_data_get(uint16_t size, bool heap) {
+    uint8_t *data = NULL;
+
+    if (size > NB_SLAB_SIZE) {
+        if (!heap)
+            return NULL;
+
+        nb_heap_collect();
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+            nb_pool_stats.heap_allocs++;
+        }
+        return malloc(size + sizeof(struct nb_shinfo_s));
+    }
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        if (size <= NB_SMALL_SIZE)
+            data = nb_slab_get(&nb_small_class);
+        if (!data)
+            data = nb_slab_get(&nb_slab_class);
+        if (!data)
+            nb_pool_stats.slab_exhausted++;
+    }
+
+    return data;
+}
+
+/*!
+ * @brief Release a heap data block. The heap is not reentrant, so
+ * a block released with interrupts disabled (e.g. by driver on tx
+ * complete) is only queued here and freed later by \a nb_heap_collect()
+ * @param data Data to release
+ */
+static void nb_heap_put(uint8_t *data) {
+    struct nb_free_slab_s *blk = (struct nb_free_slab_s *)data;
+
+    if (SREG & _BV(SREG_I)) {
+        free(data);
+        return;
+    }
+
+    blk->next = nb_heap_defer;
+    nb_heap_defer = blk;
+}
+
+/*!
+ * @brief Free the heap blocks released in interrupt.
+ * Called from the main loop (see \a net_rx_poll())
+ */
+void nb_heap_collect(void) {
+    struct nb_free_slab_s *blk;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        blk = nb_heap_defer;
+        nb_heap_defer = NULL;
+    }
+
+    while (blk) {
+        struct nb_free_slab_s *next = blk->next;
+
+        free(blk);
+        blk = next;
+    }
+}
+
+/*!
+ * @brief Release a data block
+ * @param data Data to release
+ */
+static void nb_data_put(uint8_t *data) {
+    struct nb_free_slab_s *slab = (struct nb_free_slab_s *)data;
+    struct nb_slab_class_s *cls;
+
+    if (nb_is_slab(&nb_small_class, data))
+        cls = &nb_small_class;
+    else if (nb_is_slab(&nb_slab_class, data))
+        cls = &nb_slab_class;
+    else {
+        nb_heap_put(data);
+        return;
+    }
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        slab->next = cls->free;
+        cls->free = slab;
+        nb_slab_avail++;
+    }
+}
+
+/*!
+ * @brief Check that the pool is running low. Buffers that may be held
+ * for long (socket receive queue, packets waiting for ARP) are not
+ * accepted then, so the last \a NB_POOL_RESERVE slabs and descriptors
+ * are left for the traffic that keeps the stack running (e.g. ARP)
+ * @return True if pool is low
+ */
+bool nb_pool_low(void) {
+    return ((nb_slab_avail <= NB_POOL_RESERVE) ||
+            (nb_desc_avail <= NB_POOL_RESERVE));
+}
+
 /*!
  * @brief Allocate a Network buffer
  * @param size Size to allocate
+ * @param heap Oversize request may be served from the heap
  * @return Pointer to buffer or \a NULL if error
  */
-struct net_buff_s *net_buff_alloc(uint16_t size) {
+static struct net_buff_s *nb_alloc(uint16_t size, bool heap) {
     struct net_buff_s *buff;
     uint8_t *head;
 
-    buff = malloc(sizeof(struct net_buff_s));
+    buff = nb_desc_get();
     if (!buff) {
         return NULL;
     }
     
-    head = malloc(size);
+    head = nb_data_get(size, heap);
     if (!head) {
-        free(buff);
+        nb_desc_put(buff);
         return NULL;
     }
 
-    memset(buff, 0, ((void *)&buff->head - (void *)buff));
+    memset(buff, 0, sizeof(struct net_buff_s));
 
-    buff->head = buff->data = buff->tail = head;
-    buff->end = buff->tail + size;
-    buff->mac_hdr_offset = buff->data - buff->head;
+    buff->head = head;
+    buff->end_off = size;
+    nb_shinfo(buff)->dataref = 1;
+    nb_shinfo(buff)->frag_list = NULL;
+    buff->flags.priority = NB_PRIO_NORMAL;
     buff->network_hdr_offset = buff->mac_hdr_offset + ETH_HDR_LEN;
-    buff->transport_hdr_offset = 0;
 
     return buff;
 }
 
 /*!
- * @brief Allocate a network buffer for rx on a specific device
+ * @brief Allocate a Network buffer. Oversize request is served
+ * from the heap, so it must not be called from interrupt
+ * @param size Size to allocate
+ * @return Pointer to buffer or \a NULL if error
+ */
+struct net_buff_s *net_buff_alloc(uint16_t size) {
+    return nb_alloc(size, true);
+}
+
+/*!
+ * @brief Allocate a network buffer for rx on a specific device.
+ * Buffer is taken from the pool only (never from the heap), so it
+ * may be called from interrupt. Frames longer than \a NB_SLAB_SIZE
+ * are not received
  * @param dev Network device to receive
  * @param size Size to allocate (for ethernet is eth header, data, padding, crc)
  * @return Pointer to buffer or NULL if not enough memory
@@ -56,13 +351,176 @@ struct net_buff_s *net_buff_alloc(uint16_t size) {
 struct net_buff_s *ndev_alloc_net_buff(struct net_dev_s *net_dev, uint16_t size) {
     struct net_buff_s *buff;
 
-    buff = net_buff_alloc(size);
+    buff = nb_alloc(size, false);
     if (buff)
         buff->net_dev = net_dev;
 
     return buff;
 }
 
+/*!
+ * @brief Check that the slab class has a free slab
+ * @param cls Slab class
+ * @return True if slab may be taken
+ */
+static inline bool nb_slab_free(const struct nb_slab_class_s *cls) {
+    bool ret;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        ret = (cls->free || (cls->fresh < cls->num));
+    }
+
+    return ret;
+}
+
+/*!
+ * @brief Get length of data for the next buffer of chain: as much as
+ * fits into the full slab while one is free, otherwise into the small
+ * slab, so the data is spread over the slabs of both classes
+ * @param hdr_len Headroom of buffer
+ * @param len Length of data left
+ * @return Length of data for buffer
+ */
+static uint16_t nb_chunk_size(uint16_t hdr_len, uint16_t len) {
+    uint16_t room = NB_SLAB_SIZE;
+
+    if ((hdr_len + len > NB_SMALL_SIZE) && !nb_slab_free(&nb_slab_class))
+        room = NB_SMALL_SIZE;
+    room = (hdr_len < room) ? (room - hdr_len) : 0;
+
+    return (len < room) ? len : room;
+}
+
+/*!
+ * @brief Allocate a buffer for tx of \p len bytes of data. If the data
+ * does not fit into one slab, it is splitted to the chain of fragments
+ * taken from the slabs of both classes, so a frame larger than the full
+ * slab (or when full slabs are busy) may be sent. Devices with
+ * \a NETDEV_F_SG stream the chain, for others it is linearized
+ * before transmit.
+ * The headroom of \p hdr_len is reserved in the head buffer and
+ * all the data is already put (see \a store_net_buff() to fill it).
+ * @param net_dev Network device to transmit
+ * @param hdr_len Length of headers to reserve
+ * @param len Length of data
+ * @return Pointer to head buffer or NULL if not enough memory
+ */
+struct net_buff_s *ndev_alloc_net_buff_chain(struct net_dev_s *net_dev,
+                                             uint16_t hdr_len, uint16_t len) {
+    struct net_buff_s *head, *frag;
+    uint16_t chunk;
+
+    chunk = nb_chunk_size(hdr_len, len);
+    head = ndev_alloc_net_buff(net_dev, hdr_len + chunk);
+    if (!head)
+        return NULL;
+
+    if (!reserve_net_buff(head, hdr_len)) {
+        free_net_buff(head);
+        return NULL;
+    }
+    put_net_buff(head, chunk);
+    len -= chunk;
+
+    while (len) {
+        chunk = nb_chunk_size(0, len);
+
+        frag = ndev_alloc_net_buff(net_dev, chunk);
+        if (!frag) {
+            free_net_buff(head);
+            return NULL;
+        }
+
+        put_net_buff(frag, chunk);
+        append_frag_net_buff(head, frag);
+        len -= chunk;
+    }
+
+    return head;
+}
+
+/*!
+ * @brief Append a fragment to the end of buffer data
+ * @param net_buff Head buffer
+ * @param frag Fragment to append
+ */
+void append_frag_net_buff(struct net_buff_s *net_buff,
+                          struct net_buff_s *frag) {
+    struct net_buff_s **last = &nb_shinfo(net_buff)->frag_list;
+
+    while (*last)
+        last = &(*last)->next;
+
+    frag->next = NULL;
+    *last = frag;
+
+    net_buff->data_len += nb_len(frag);
+}
+
+/*!
+ * @brief Copy data to the buffer, including fragments
+ * @param net_buff Buffer to copy to
+ * @param offset Offset from the buffer data to start
+ * @param from Source data
+ * @param len Length of data to copy
+ */
+void store_net_buff(struct net_buff_s *net_buff, uint16_t offset,
+                    const void *from, uint16_t len) {
+    struct net_buff_s *frag = net_buff;
+    const uint8_t *src = from;
+
+    while (frag && len) {
+        uint16_t chunk = nb_headlen(frag);
+
+        if (offset < chunk) {
+            chunk -= offset;
+            if (chunk > len)
+                chunk = len;
+
+            memcpy(nb_data(frag) + offset, src, chunk);
+            src += chunk;
+            len -= chunk;
+            offset = 0;
+        } else {
+            offset -= chunk;
+        }
+
+        frag = (frag == net_buff) ? nb_shinfo(net_buff)->frag_list : frag->next;
+    }
+}
+
+/*!
+ * @brief Copy data from the buffer, including fragments
+ * @param net_buff Buffer to copy from
+ * @param offset Offset from the buffer data to start
+ * @param to Destination
+ * @param len Length of data to copy
+ */
+void load_net_buff(const struct net_buff_s *net_buff, uint16_t offset,
+                   void *to, uint16_t len) {
+    const struct net_buff_s *frag = net_buff;
+    uint8_t *dst = to;
+
+    while (frag && len) {
+        uint16_t chunk = nb_headlen(frag);
+
+        if (offset < chunk) {
+            chunk -= offset;
+            if (chunk > len)
+                chunk = len;
+
+            memcpy(dst, nb_data(frag) + offset, chunk);
+            dst += chunk;
+            len -= chunk;
+            offset = 0;
+        } else {
+            offset -= chunk;
+        }
+
+        frag = (frag == net_buff) ? nb_shinfo(net_buff)->frag_list : frag->next;
+    }
+}
+
 /*!
  * @brief Put a data to the buffer
  * @param net_buff Buffer to adding
@@ -70,12 +528,11 @@ struct net_buff_s *ndev_alloc_net_buff(struct net_dev_s *net_dev, uint16_t size)
  * @return Pointer to tail of buffer
  */
 void *put_net_buff(struct net_buff_s *net_buff, uint16_t len) {
-    void *old_tail = net_buff->tail;
+    void *old_tail = nb_tail(net_buff);
 
-    net_buff->tail += len;
-    net_buff->pkt_len += len;
+    net_buff->tail_off += len;
 
-    if (net_buff->tail > net_buff->end) {
+    if (net_buff->tail_off > net_buff->end_off) {
         /** TODO: error - out of range */
         printf_P(PSTR("Out of range!!! Stopping...\n"));
         while (1) {}
@@ -85,11 +542,157 @@ void *put_net_buff(struct net_buff_s *net_buff, uint16_t len) {
 }
 
 /*!
- * @brief Free the allocating memory an Net Buffer
+ * @brief Reserve a headroom in the empty buffer. Used to make
+ * a room for the headers of the lower layers before data is added.
+ * Offset of data is 8-bit, so headroom is limited to 255 bytes.
+ * @param net_buff Buffer to reserve
+ * @param len Length of headroom
+ * @return Pointer to start of data or \a NULL if \p len is out of range
+ */
+void *reserve_net_buff(struct net_buff_s *net_buff, uint16_t len) {
+    if ((net_buff->data_off + len > UINT8_MAX) ||
+        (net_buff->tail_off + len > net_buff->end_off))
+        return NULL;
+
+    net_buff->data_off += len;
+    net_buff->tail_off += len;
+
+    return nb_data(net_buff);
+}
+
+/*!
+ * @brief Push a header in front of the data
+ * @param net_buff Buffer to adding
+ * @param len Length of header
+ * @return Pointer to new start of data or \a NULL if no headroom
+ */
+void *push_net_buff(struct net_buff_s *net_buff, uint16_t len) {
+    if (len > nb_headroom(net_buff))
+        return NULL;
+
+    net_buff->data_off -= len;
+
+    return nb_data(net_buff);
+}
+
+/*!
+ * @brief Remove a header from the start of the data. Offset of data
+ * is 8-bit, so the data may not start beyond 255 bytes of buffer.
+ * @param net_buff Buffer to remove from
+ * @param len Length of header
+ * @return Pointer to new start of data or \a NULL if buffer too short
+ *         or \p len is out of range
+ */
+void *pull_net_buff(struct net_buff_s *net_buff, uint16_t len) {
+    if ((len > nb_headlen(net_buff)) ||
+        (net_buff->data_off + len > UINT8_MAX))
+        return NULL;
+
+    net_buff->data_off += len;
+
+    return nb_data(net_buff);
+}
+
+/*!
+ * @brief Cut the data to the given length (e.g. remove padding and CRC).
+ * Only linear buffers may be trimmed.
+ * @param net_buff Buffer to trim
+ * @param len New length of data
+ */
+void trim_net_buff(struct net_buff_s *net_buff, uint16_t len) {
+    if ((nb_len(net_buff) <= len) || net_buff->data_len)
+        return;
+
+    net_buff->tail_off = net_buff->data_off + len;
+}
+
+/*!
+ * @brief Drop the reference to the buffer data. The data and
+ * its fragments are freed with the last reference.
+ * @param net_buff Buffer to release
+ */
+static void nb_data_release(struct net_buff_s *net_buff) {
+    uint8_t dataref;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        dataref = --nb_shinfo(net_buff)->dataref;
+    }
+
+    if (dataref)
+        return;
+
+    free_net_buff_list(nb_shinfo(net_buff)->frag_list);
+    nb_data_put(net_buff->head);
+}
+
+/*!
+ * @brief Copy all the fragments to one contiguous data block.
+ * Used for devices that are not able to transmit a chain.
+ * @param net_buff Buffer to linearize
+ * @return 0 if success; -1 if not enough memory
+ */
+int8_t linearize_net_buff(struct net_buff_s *net_buff) {
+    struct net_buff_s *frag;
+    uint16_t headlen = net_buff->tail_off;  // headroom and linear data
+    uint16_t size = headlen + net_buff->data_len;
+    uint8_t *head, *ptr;
+
+    if (!net_buff->data_len)
+        return 0;
+
+    head = nb_data_get(size, true);
+    if (!head)
+        return -1;
+
+    memcpy(head, net_buff->head, headlen);
+    ptr = head + headlen;
+    nb_for_each_frag(net_buff, frag) {
+        memcpy(ptr, nb_data(frag), nb_len(frag));
+        ptr += nb_len(frag);
+    }
+
+    nb_data_release(net_buff);
+
+    net_buff->head = head;
+    net_buff->tail_off = size;
+    net_buff->end_off = size;
+    net_buff->data_len = 0;
+    nb_shinfo(net_buff)->dataref = 1;
+    nb_shinfo(net_buff)->frag_list = NULL;
+
+    return 0;
+}
+
+/*!
+ * @brief Clone the buffer. New descriptor refers to the same data,
+ * so the data is not copied and is freed with the last reference.
+ * @param net_buff Buffer to clone
+ * @return Pointer to clone or \a NULL if no memory
+ */
+struct net_buff_s *clone_net_buff(struct net_buff_s *net_buff) {
+    struct net_buff_s *clone;
+
+    clone = nb_desc_get();
+    if (!clone)
+        return NULL;
+
+    memcpy(clone, net_buff, sizeof(struct net_buff_s));
+    clone->next = NULL;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        nb_shinfo(net_buff)->dataref++;
+    }
+
+    return clone;
+}
+
+/*!
+ * @brief Free the allocating memory an Net Buffer.
+ * The data is freed only when it is not referenced by any clone.
  */
 void free_net_buff(struct net_buff_s *net_buff) {
-    free(net_buff->head);
-    free(net_buff);
+    nb_data_release(net_buff);
+    nb_desc_put(net_buff);
 }
 
 /*!
@@ -104,6 +707,27 @@ void free_net_buff_list(struct net_buff_s *net_buff) {
     }
 }
 
+/*!
+ * @brief Advance the network time. Must be called \a NET_HZ times
+ * per second, usually from the timer interrupt.
+ */
+void net_tick(void) {
+    jiffies++;
+}
+
+/*!
+ * @brief Get the network time
+ * @return Number of ticks since start
+ */
+uint32_t net_jiffies(void) {
+    uint32_t j;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        j = jiffies;
+    }
+    return j;
+}
+
 /*!
  * @brief Initialize the net working
  */
@@ -1,9 +1,11 @@
 #ifndef NET_NET_H
 #define NET_NET_H
 
+#include <avr/io.h>
 #include <avr/pgmspace.h>
 
 #include <stdint.h>
+#include <stdbool.h>
 #include <stdio.h>
 
 #include <defines.h>
@@ -35,9 +37,62 @@
 #define CHECKSUM_HW             1   // The device has already performed CRC calculation at the hardware level.
 #define CHECKSUM_UNNECESSARY    2   // Do not perform any CRC calculations.
 
+/* Transmit priority (band of device tx queue) */
+#define NB_PRIO_CTRL   0    // control traffic, low delay
+#define NB_PRIO_NORMAL 1    // best effort
+#define NB_PRIO_BULK   2    // bulk transfer
+
 /* Hardware Types */
 #define HWT_ETHER 1
 
+/* Network buffer pool: descriptors, data slabs of full frame size and
+ * small slabs, so a short frame (ARP, ICMP, short UDP) does not take
+ * a full slab. Defaults are sized by SRAM of the part, on 2 KB parts
+ * the full slab is cut down (DHCP still fits) and longer frames are not
+ * received. May be overridden at compile time */
+#ifndef NB_POOL_SIZE
+#if defined(RAMEND) && (RAMEND < 0x1000)    // 2 KB of SRAM
+#define NB_POOL_SIZE 7  // Number of buffer descriptors
+#else
+#define NB_POOL_SIZE 8
+#endif
+#endif
+#ifndef NB_SLAB_NUM
+#if defined(RAMEND) && (RAMEND < 0x2000)    // up to 4 KB of SRAM
+#define NB_SLAB_NUM 1   // Number of data slabs
+#else
+#define NB_SLAB_NUM 2
+#endif
+#endif
+#ifndef NB_SLAB_SIZE
+#if defined(RAMEND) && (RAMEND < 0x1000)    // 2 KB of SRAM
+#define NB_SLAB_SIZE 600    // Size of one data slab
+#else
+#define NB_SLAB_SIZE (ETH_FRAME_LEN + ETH_FCS_LEN)
+#endif
+#endif
+#ifndef NB_SMALL_NUM
+#define NB_SMALL_NUM 4  // Number of small data slabs
+#endif
+#ifndef NB_SMALL_SIZE
+#if defined(RAMEND) && (RAMEND < 0x1000)    // 2 KB of SRAM
+#define NB_SMALL_SIZE 64    // Size of one small data slab
+#else
+#define NB_SMALL_SIZE 128
+#endif
+#endif
+/* Slabs and descriptors kept free for ARP, see nb_pool_low() */
+#ifndef NB_POOL_RESERVE
+#define NB_POOL_RESERVE 1
+#endif
+
+/* Limit of static RAM taken by the stack tables (buffer pool, ARP cache,
+ * routing table, socket hash) on 2 KB parts, checked at compile time.
+ * The rest is left for devices, sockets, call stack and application */
+#ifndef NET_STATIC_RAM_MAX
+#define NET_STATIC_RAM_MAX 1280
+#endif
+
 struct socket;
 struct sockaddr;
 struct msghdr;
@@ -58,73 +113,283 @@ struct protocol_ops {
                       const struct sockaddr *addr,
                       uint8_t addr_len);
     int8_t (*listen)(struct socket *sk, uint8_t backlog);
+    int8_t (*setsockopt)(struct socket *sk, uint8_t level, uint8_t optname,
+                         const void *optval, uint8_t optlen);
     ssize_t (*sendmsg)(struct socket *restrict sk,
                        struct msghdr *restrict msg);
     ssize_t (*recvmsg)(struct socket *restrict sk,
                        struct msghdr *restrict msg,
                        size_t len, uint8_t flags);
+    ssize_t (*recv_zc)(struct socket *restrict sk,
+                       struct msghdr *restrict msg,
+                       struct net_buff_s **nb, uint8_t flags);
+    struct net_buff_s *(*alloc_send)(struct socket *sk, uint16_t len);
+    ssize_t (*commit_send)(struct socket *sk, struct net_buff_s *nb);
 };
 
 /**
- * @brief
+ * @brief Network buffer. Packet data lies between \a data and \a tail.
+ * Free space before \a data (headroom) is used to push the headers of
+ * lower layers; free space after \a tail (tailroom) is used to put data.
+ * All positions are kept as offsets from \a head, packet length is
+ * derived from them. Use the accessors (e.g. \a nb_data(), \a nb_len())
+ * instead of the fields.
  * 
  * @param next Next buffer in queue
- * @param prev Previos buffer in queue
  * 
  * @param net_dev Network device
  * @param sock Socket for this packet
  * 
- * @param pkt_len Packet length
- * @param data_len Length of data
- * @param protocol Packet protocol
+ * @param head Pointer to start of buffer
+ * @param tail_off Offset of the end of linear data
+ * @param end_off Offset of the end of buffer (shared info is here)
  * 
- * @param pkt_type Packet type
- * @param ip_summed Check CRC
+ * @param data_len Length of data in fragments
+ * @param protocol Packet protocol
  * 
+ * @param data_off Offset of actual data
  * @param transport_hdr_offset Offset from start frame to Transport Layer header (layer 4)
  * @param network_hdr_offset Offset from start frame to Network Layer header (layer 3)
  * @param mac_hdr_offset Offset from start frame to Data Link Layer header (layer 2)
  * 
- * @param head Pointer to start of buffer
- * @param data Pointer to actual data - ethernet frame (data link layer - layer 2)
- * @param tail Tail pointer
- * @param end End pointer
+ * @param pkt_type Packet type
+ * @param ip_summed Check CRC
+ * @param priority Transmit priority (e.g. NB_PRIO_CTRL)
  */
 struct net_buff_s {
-    struct net_buff_s *next,
-                      *prev;
+    struct net_buff_s *next;
 
     struct net_dev_s *net_dev;
     struct socket *sock;
 
-    uint16_t pkt_len;
+    uint8_t *head;
+    uint16_t tail_off;
+    uint16_t end_off;
+
     uint16_t data_len;
     uint16_t protocol;
 
+    uint8_t data_off;
+    uint8_t transport_hdr_offset;
+    uint8_t network_hdr_offset;
+    uint8_t mac_hdr_offset;
+
     struct {
-        uint8_t pkt_type : 2;
+        uint8_t pkt_type : 3;
         uint8_t ip_summed : 2;
+        uint8_t priority : 2;
     } flags;
+};
 
-    uint8_t transport_hdr_offset;
-    uint8_t network_hdr_offset;
-    uint8_t mac_hdr_offset;
+/* 4 pointers + 13 bytes: 21 bytes per buffer on AVR */
+#if defined(__AVR__)
+_Static_assert(sizeof(struct net_buff_s) == 21,
+               "unexpected size of struct net_buff_s");
+#endif
 
-    uint8_t *head;
-    uint8_t *data;
-    uint8_t *tail;
-    uint8_t *end;
+/*!
+ * @brief Network buffer pool statistics
+ * @param desc_exhausted Allocations failed due to no free descriptor
+ * @param slab_exhausted Allocations failed due to no free data slab
+ * @param heap_allocs Oversize allocations served from the heap
+ */
+struct nb_pool_stats_s {
+    uint16_t desc_exhausted;
+    uint16_t slab_exhausted;
+    uint16_t heap_allocs;
+};
+
+extern struct nb_pool_stats_s nb_pool_stats;
+
+/* Frequency of net_tick() calls, Hz. May be overridden at compile time */
+#ifndef NET_HZ
+#define NET_HZ 100
+#endif
+
+/*!
+ * @brief Check that time \p a is after time \p b (in jiffies).
+ * Counter wrap is handled.
+ */
+#define net_time_after(a, b) ((int32_t)((uint32_t)(b) - (uint32_t)(a)) < 0)
+
+/*!
+ * @brief Shared info of buffer data. Placed just after the end of data,
+ * so it is common for all clones of the buffer.
+ * @param dataref Number of buffers referencing to the data
+ * @param frag_list List of buffers with payload fragments
+ *                  (linked through \a next)
+ */
+struct nb_shinfo_s {
+    uint8_t dataref;
+    struct net_buff_s *frag_list;
 };
 
 typedef int8_t (*proto_hdlr_t)(struct net_buff_s *net_buff);
 
 struct net_buff_s *net_buff_alloc(uint16_t size);
+bool nb_pool_low(void);
+void nb_heap_collect(void);
 struct net_buff_s *ndev_alloc_net_buff(struct net_dev_s *net_dev, uint16_t size);
+struct net_buff_s *ndev_alloc_net_buff_chain(struct net_dev_s *net_dev,
+                                             uint16_t hdr_len, uint16_t len);
+void append_frag_net_buff(struct net_buff_s *net_buff,
+                          struct net_buff_s *frag);
+void store_net_buff(struct net_buff_s *net_buff, uint16_t offset,
+                    const void *from, uint16_t len);
+void load_net_buff(const struct net_buff_s *net_buff, uint16_t offset,
+                   void *to, uint16_t len);
+int8_t linearize_net_buff(struct net_buff_s *net_buff);
+void *reserve_net_buff(struct net_buff_s *net_buff, uint16_t len);
 void *put_net_buff(struct net_buff_s *net_buff, uint16_t len);
+void *push_net_buff(struct net_buff_s *net_buff, uint16_t len);
+void *pull_net_buff(struct net_buff_s *net_buff, uint16_t len);
+void trim_net_buff(struct net_buff_s *net_buff, uint16_t len);
+struct net_buff_s *clone_net_buff(struct net_buff_s *net_buff);
 void free_net_buff(struct net_buff_s *net_buff);
 void free_net_buff_list(struct net_buff_s *net_buff);
 
 void network_init(void);
+void net_tick(void);
+uint32_t net_jiffies(void);
+
+/*!
+ * @brief Get the shared info of buffer data
+ * @param net_buff Network buffer
+ * @return Pointer to shared info
+ */
+static inline struct nb_shinfo_s *nb_shinfo(const struct net_buff_s *net_buff) {
+    return (struct nb_shinfo_s *)(net_buff->head + net_buff->end_off);
+}
+
+/*!
+ * @brief Check if the buffer data is shared with a clone.
+ * Data of the cloned buffer must be treated as read-only.
+ * @param net_buff Network buffer
+ * @return True if buffer is cloned
+ */
+static inline bool nb_cloned(const struct net_buff_s *net_buff) {
+    return nb_shinfo(net_buff)->dataref > 1;
+}
+
+/*!
+ * @brief Check if the checksums of received buffer are already
+ * verified by the device or need not be verified (e.g. looped back)
+ * @param net_buff Network buffer
+ * @return True if software verification can be skipped
+ */
+static inline bool nb_csum_unnecessary(const struct net_buff_s *net_buff) {
+    return net_buff->flags.ip_summed != CHECKSUM_NONE;
+}
+
+/*!
+ * @brief Get pointer to actual data
+ * @param net_buff Network buffer
+ * @return Pointer to data
+ */
+static inline uint8_t *nb_data(const struct net_buff_s *net_buff) {
+    return net_buff->head + net_buff->data_off;
+}
+
+/*!
+ * @brief Get pointer to the end of linear data
+ * @param net_buff Network buffer
+ * @return Tail pointer
+ */
+static inline uint8_t *nb_tail(const struct net_buff_s *net_buff) {
+    return net_buff->head + net_buff->tail_off;
+}
+
+/*!
+ * @brief Get length of the linear part of buffer data
+ * @param net_buff Network buffer
+ * @return Length of data without fragments
+ */
+static inline uint16_t nb_headlen(const struct net_buff_s *net_buff) {
+    return net_buff->tail_off - net_buff->data_off;
+}
+
+/*!
+ * @brief Get packet length
+ * @param net_buff Network buffer
+ * @return Length of linear data and fragments
+ */
+static inline uint16_t nb_len(const struct net_buff_s *net_buff) {
+    return nb_headlen(net_buff) + net_buff->data_len;
+}
+
+/*!
+ * @brief Get pointer to the Data Link Layer header
+ * @param net_buff Network buffer
+ */
+static inline void *nb_mac_hdr(const struct net_buff_s *net_buff) {
+    return net_buff->head + net_buff->mac_hdr_offset;
+}
+
+/*!
+ * @brief Get pointer to the Network Layer header
+ * @param net_buff Network buffer
+ */
+static inline void *nb_network_hdr(const struct net_buff_s *net_buff) {
+    return net_buff->head + net_buff->network_hdr_offset;
+}
+
+/*!
+ * @brief Get pointer to the Transport Layer header
+ * @param net_buff Network buffer
+ */
+static inline void *nb_transport_hdr(const struct net_buff_s *net_buff) {
+    return net_buff->head + net_buff->transport_hdr_offset;
+}
+
+/*!
+ * @brief Set the Data Link Layer header to the actual data
+ * @param net_buff Network buffer
+ */
+static inline void nb_reset_mac_hdr(struct net_buff_s *net_buff) {
+    net_buff->mac_hdr_offset = net_buff->data_off;
+}
+
+/*!
+ * @brief Set the Network Layer header to the actual data
+ * @param net_buff Network buffer
+ */
+static inline void nb_reset_network_hdr(struct net_buff_s *net_buff) {
+    net_buff->network_hdr_offset = net_buff->data_off;
+}
+
+/*!
+ * @brief Set the Transport Layer header to the actual data
+ * @param net_buff Network buffer
+ */
+static inline void nb_reset_transport_hdr(struct net_buff_s *net_buff) {
+    net_buff->transport_hdr_offset = net_buff->data_off;
+}
+
+/*!
+ * @brief Iterate over a fragments of buffer
+ * @param nb Head buffer
+ * @param frag Fragment buffer to iterate
+ */
+#define nb_for_each_frag(nb, frag)  \
+        for (frag = nb_shinfo(nb)->frag_list; frag; frag = frag->next)
+
+/*!
+ * @brief Get free space at the start of buffer
+ * @param net_buff Network buffer
+ * @return Headroom length
+ */
+static inline uint16_t nb_headroom(const struct net_buff_s *net_buff) {
+    return net_buff->data_off;
+}
+
+/*!
+ * @brief Get free space at the end of buffer
+ * @param net_buff Network buffer
+ * @return Tailroom length
+ */
+static inline uint16_t nb_tailroom(const struct net_buff_s *net_buff) {
+    return net_buff->end_off - net_buff->tail_off;
+}
 
 /*!
  * @brief Peek an Network buffer
@@ -154,14 +419,27 @@ static inline void nb_queue_init(struct nb_queue_s *q) {
  * @param q Queue to use
  */
 static inline void nb_enqueue(struct net_buff_s *new, struct nb_queue_s *q) {
-    struct net_buff_s *next, *prev;
+    struct net_buff_s *last = q->prev;
 
-    next = (struct net_buff_s *)q;
-    prev = next->prev;
+    /* if queue is empty, \a last is the queue itself,
+     * so \a last->next is \a q->next */
+    new->next = (struct net_buff_s *)q;
+    last->next = new;
+    q->prev = new;
+    q->q_len++;
+}
 
-    new->next = next;
-    new->prev = prev;
-    next->prev = prev->next = new;
+/*!
+ * @brief Enqueue the buffer at the start of a queue
+ * @param new Buffer to enqueue
+ * @param q Queue to use
+ */
+static inline void nb_enqueue_head(struct net_buff_s *new,
+                                   struct nb_queue_s *q) {
+    new->next = q->next;
+    q->next = new;
+    if (q->prev == (struct net_buff_s *)q)
+        q->prev = new;
     q->q_len++;
 }
 
@@ -171,16 +449,15 @@ static inline void nb_enqueue(struct net_buff_s *new, struct nb_queue_s *q) {
  * @return Dequeue buffer
  */
 static inline struct net_buff_s *nb_dequeue(struct nb_queue_s *q) {
-    struct net_buff_s *next, *prev, *ret;
+    struct net_buff_s *ret;
 
     ret = nb_peek(q);
     if (ret) {
         q->q_len--;
-        next = ret->next;
-        prev = ret->prev;
-        ret->prev = ret->next = NULL;
-        next->prev = prev;
-        prev->next = next;
+        q->next = ret->next;
+        if (q->prev == ret)
+            q->prev = (struct net_buff_s *)q;
+        ret->next = NULL;
     }
     return ret;
 }
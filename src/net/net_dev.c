@@ -1,4 +1,5 @@
 #include <avr/pgmspace.h>
+#include <util/atomic.h>
 
 #include <stdint.h>
 #include <stdlib.h>
@@ -9,8 +10,19 @@
 #include "net/net.h"
 #include "net/net_dev.h"
 #include "net/nb_queue.h"
+#include "net/interrupt.h"
+#include "arpa/inet.h"
+#include "netinet/route.h"
+#include "netinet/arp.h"
 
-struct net_dev_s *curr_net_dev = NULL;  // global current network device
+struct net_dev_s *net_dev_list = NULL;  // list of registered devices
+
+/* Length limits of the transmit queue bands */
+static const uint8_t netdev_tx_band_len[NETDEV_TX_BANDS] PROGMEM = {
+    [NB_PRIO_CTRL] = NETDEV_TX_CTRL_LEN,
+    [NB_PRIO_NORMAL] = NETDEV_TX_NORMAL_LEN,
+    [NB_PRIO_BULK] = NETDEV_TX_BULK_LEN,
+};
 
 /*!
  * @brief Allocate & Set Network Device
@@ -28,6 +40,11 @@ struct net_dev_s *net_dev_alloc(uint8_t size, void (*setup)(struct net_dev_s *))
 
     memset(ndev, 0, sizeof(struct net_dev_s) + size);
     ndev->priv = (void *)ndev + sizeof(struct net_dev_s);
+    ndev->ip_addr = htonl(INADDR_NONE);
+    ndev->ip_mask = htonl(INADDR_NONE);
+    ndev->ip_gw = htonl(INADDR_NONE);
+    for (uint8_t i = 0; i < NETDEV_TX_BANDS; i++)
+        nb_queue_init(&ndev->tx_q[i]);
     setup(ndev);
 
     return ndev;
@@ -42,22 +59,50 @@ void net_dev_free(struct net_dev_s *net_dev) {
 }
 
 /*!
- * @brief Register a network device
+ * @brief Drop all buffers waiting for transmission
+ * @param net_dev Network device
+ */
+static void netdev_tx_queue_clear(struct net_dev_s *net_dev) {
+    struct net_buff_s *nb;
+
+    for (uint8_t i = 0; i < NETDEV_TX_BANDS; i++) {
+        do {
+            ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+                nb = nb_dequeue(&net_dev->tx_q[i]);
+            }
+            if (nb)
+                free_net_buff(nb);
+        } while (nb);
+    }
+}
+
+/*!
+ * @brief Register a network device. Device is added to the end
+ * of device list, so the first registered device is the default one.
  * @param net_dev Device to register
  * @return 0 if success; errno if error
  */
 int8_t netdev_register(struct net_dev_s *net_dev) {
     int8_t (*init_f)(struct net_dev_s *);
     init_f = pgm_read_ptr(&net_dev->netdev_ops->init);
+    struct net_dev_s **pp = &net_dev_list;
     int8_t err = 0;
 
+    while (*pp) {
+        if (*pp == net_dev)
+            // EEXIST
+            return -1;
+        pp = &(*pp)->next;
+    }
+
     if (init_f) {
         err = init_f(net_dev);
         if (err)
             return err;
     }
 
-    curr_net_dev = net_dev;
+    net_dev->next = NULL;
+    *pp = net_dev;
 
     return err;
 }
@@ -69,11 +114,54 @@ int8_t netdev_register(struct net_dev_s *net_dev) {
 void netdev_unregister(struct net_dev_s *net_dev) {
     void (*stop_f)(struct net_dev_s *);
     stop_f = pgm_read_ptr(&net_dev->netdev_ops->stop);
+    struct net_dev_s **pp;
 
     if (stop_f)
         stop_f(net_dev);
 
-    curr_net_dev = NULL;
+    irq_hdlr_del(net_dev);
+    netdev_tx_queue_clear(net_dev);
+    route_dev_flush(net_dev);
+    arp_dev_flush(net_dev);
+
+    for (pp = &net_dev_list; *pp; pp = &(*pp)->next) {
+        if (*pp == net_dev) {
+            *pp = net_dev->next;
+            break;
+        }
+    }
+    net_dev->next = NULL;
+}
+
+/*!
+ * @brief Find the registered device with IP address \p addr
+ * @param addr IP address (network byte order)
+ * @return Pointer to device or \a NULL if not found
+ */
+struct net_dev_s *netdev_get_by_inaddr(in_addr_t addr) {
+    struct net_dev_s *ndev;
+
+    net_dev_for_each(ndev) {
+        if (ndev->ip_addr == addr)
+            return ndev;
+    }
+    return NULL;
+}
+
+/*!
+ * @brief Get the default device: first registered device
+ * that is running and has IP address
+ * @return Pointer to device or \a NULL if there is no one
+ */
+struct net_dev_s *netdev_get_default(void) {
+    struct net_dev_s *ndev;
+
+    net_dev_for_each(ndev) {
+        if (net_dev_upstate_is_run(ndev) &&
+            (ndev->ip_addr != htonl(INADDR_NONE)))
+            return ndev;
+    }
+    return NULL;
 }
 
 /*!
@@ -128,6 +216,7 @@ void netdev_close(struct net_dev_s *net_dev) {
     if (stop_f)
         stop_f(net_dev);
 
+    netdev_tx_queue_clear(net_dev);
     net_dev_set_upstate_stop(net_dev);
 }
 
@@ -140,72 +229,199 @@ static inline int8_t netdev_start_tx(struct net_buff_s *net_buff,
 }
 
 /*!
- * @brief Start transmit a list of buffers
+ * @brief Put the buffer to the band of device transmit queue
+ * according to the buffer priority. Called from the main loop only:
+ * the chain is linearized here for devices that can't stream it, so
+ * the transmit path, that may run in interrupt, never uses the heap.
+ * @param net_buff Buffer to transmit
+ * @param net_dev Network device
+ * @return NET_XMIT_SUCCESS, NET_XMIT_CN or NET_XMIT_DROP
+ */
+static int8_t netdev_enqueue(struct net_buff_s *net_buff,
+                             struct net_dev_s *net_dev) {
+    uint8_t band = net_buff->flags.priority;
+    uint8_t limit;
+    struct nb_queue_s *q;
+    int8_t ret = NET_XMIT_SUCCESS;
+
+    /* device can't stream a chain - make it contiguous */
+    if (net_buff->data_len && !(net_dev->features & NETDEV_F_SG) &&
+        linearize_net_buff(net_buff)) {
+        net_dev->stats.tx_dropped++;
+        free_net_buff(net_buff);
+        return NET_XMIT_DROP;
+    }
+
+    if (band >= NETDEV_TX_BANDS)
+        band = NB_PRIO_NORMAL;
+    q = &net_dev->tx_q[band];
+    limit = pgm_read_byte(&netdev_tx_band_len[band]);
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        if (q->q_len >= limit) {
+            ret = NET_XMIT_DROP;
+        } else {
+            nb_enqueue(net_buff, q);
+            if (q->q_len >= limit)
+                ret = NET_XMIT_CN;
+        }
+    }
+
+    if (ret == NET_XMIT_DROP) {
+        net_dev->stats.tx_dropped++;
+        free_net_buff(net_buff);
+    }
+
+    return ret;
+}
+
+/*!
+ * @brief Get the highest priority band of transmit queue that is not empty
+ * @param net_dev Network device
+ * @return Pointer to queue or \a NULL if all bands are empty
+ */
+static struct nb_queue_s *netdev_tx_band(struct net_dev_s *net_dev) {
+    for (uint8_t i = 0; i < NETDEV_TX_BANDS; i++) {
+        if (nb_peek(&net_dev->tx_q[i]))
+            return &net_dev->tx_q[i];
+    }
+    return NULL;
+}
+
+/*!
+ * @brief Transmit buffers from the device queue while controller is free
+ * @param net_dev Network device
+ */
+static void netdev_tx_queue_run(struct net_dev_s *net_dev) {
+    struct nb_queue_s *q;
+    struct net_buff_s *nb;
+    int8_t err;
+
+    while (net_dev_tx_is_allow(net_dev)) {
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+            nb = NULL;
+            q = netdev_tx_band(net_dev);
+            if (q)
+                nb = nb_dequeue(q);
+        }
+        if (!nb)
+            break;
+
+        err = netdev_start_tx(nb, net_dev);
+
+        if (!net_dev_xmit_complete(err)) {
+            /* busy - return to queue and wait for tx complete */
+            ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+                nb_enqueue_head(nb, q);
+            }
+            return;
+        }
+        if (err == NETDEV_TX_OK)
+            net_dev->stats.tx_packets++;
+    }
+}
+
+/*!
+ * @brief Start transmit of queued buffers. Does not wait for the
+ * controller: the rest of queue is transmitted on tx complete.
+ * May be called from interrupt.
+ * @param net_dev Network device
+ */
+void netdev_tx_run(struct net_dev_s *net_dev) {
+    bool busy;
+
+    do {
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+            busy = net_dev->xmit_lock;
+            net_dev->xmit_lock = true;
+        }
+        if (busy)
+            return;     // queue is already served
+
+        netdev_tx_queue_run(net_dev);
+        net_dev->xmit_lock = false;
+
+        /* tx might be completed while the lock was held (also after
+         * the controller reported busy): that completion found the
+         * lock taken and did not serve the queue */
+    } while (net_dev_tx_is_allow(net_dev) && netdev_tx_band(net_dev));
+}
+
+/*!
+ * @brief Transmission is completed. Called by driver
+ * (usually from the tx complete interrupt).
+ * @param net_dev Network device
+ */
+void netdev_tx_complete(struct net_dev_s *net_dev) {
+    net_dev_tx_allow(net_dev);
+    netdev_tx_run(net_dev);
+
+    if (net_dev->tx_done_cb)
+        net_dev->tx_done_cb(net_dev);
+}
+
+/*!
+ * @brief Start transmit a list of buffers. Buffers are queued
+ * to the device, function returns without waiting for transmission.
  * @param net_buff buffer to transmit
- * @return 0 on success
+ * @return 0 on success; NET_XMIT_CN if device queue band is full;
+ *         NET_XMIT_DROP if some buffers were dropped; -1 if device is down
  */
 int8_t netdev_list_xmit(struct net_buff_s *net_buff) {
     struct net_dev_s *net_dev = net_buff->net_dev;
-    int8_t err = NETDEV_TX_BUSY;
+    int8_t err = NET_XMIT_SUCCESS;
 
-    while (net_dev_upstate_is_run(net_dev) &&
-           net_dev_link_is_up(net_dev) &&
-           net_buff) {
-        if (!net_dev_tx_is_allow(net_dev))
-            continue;
+    if (!net_dev_upstate_is_run(net_dev) ||
+        !net_dev_link_is_up(net_dev)) {
+        free_net_buff_list(net_buff);
+        return -1;  // ENETDOWN
+    }
 
+    while (net_buff) {
         struct net_buff_s *next = net_buff->next;
+        int8_t ret;
 
         net_buff->next = NULL;
-
-        err = netdev_start_tx(net_buff, net_dev);
-
-        if (!net_dev_xmit_complete(err)) {
-            net_buff->next = next;
-            continue;
-        }
+        ret = netdev_enqueue(net_buff, net_dev);
+        if (ret > err)
+            err = ret;
 
         net_buff = next;
     }
 
-    if (net_dev_xmit_complete(err))
-        return err;
-
-    err = -1;   // ENETDOWN
-    free_net_buff_list(net_buff);
+    netdev_tx_run(net_dev);
 
     return err;
 }
 
 /*!
- * @brief Start transmit a queue of buffers
+ * @brief Start transmit a queue of buffers. Buffers are moved
+ * to the device queue, function returns without waiting for transmission.
  * @param queue Queue to transmit
- * @return 0 on success
+ * @return 0 on success; NET_XMIT_CN if device queue band is full;
+ *         NET_XMIT_DROP if some buffers were dropped; -1 if device is down
  */
 int8_t netdev_queue_xmit(struct nb_queue_s *queue) {
     struct net_buff_s *nb;
-    int8_t err = NETDEV_TX_OK;
+    int8_t err = NET_XMIT_SUCCESS;
 
     while ((nb = nb_dequeue(queue))) {
         struct net_dev_s *ndev = nb->net_dev;
-        err = -1;   // ENETDOWN
-
-        while (net_dev_upstate_is_run(ndev) &&
-               net_dev_link_is_up(ndev)) {
-            if (!net_dev_tx_is_allow(ndev))
-                continue;
-
-            err = netdev_start_tx(nb, ndev);
-
-            if (net_dev_xmit_complete(err))
-                break;
-        }
+        int8_t ret;
 
-        if (!net_dev_xmit_complete(err)) {
+        if (!net_dev_upstate_is_run(ndev) ||
+            !net_dev_link_is_up(ndev)) {
+            free_net_buff(nb);
             nb_queue_clear(queue);
             err = -1;   // ENETDOWN
             break;
         }
+
+        ret = netdev_enqueue(nb, ndev);
+        if (ret > err)
+            err = ret;
+
+        netdev_tx_run(ndev);
     }
 
     return err;
@@ -219,6 +435,7 @@ int8_t netdev_queue_xmit(struct nb_queue_s *queue) {
  */
 int8_t netdev_set_mac_addr(struct net_dev_s *net_dev, const void *addr) {
     int8_t (*set_mac_addr_f)(struct net_dev_s *, const void *);
+    int8_t err;
     set_mac_addr_f = pgm_read_ptr(&net_dev->netdev_ops->set_mac_addr);
 
     if (!addr)
@@ -229,5 +446,10 @@ int8_t netdev_set_mac_addr(struct net_dev_s *net_dev, const void *addr) {
         // EOPNOTSUPP
         return -1;
 
-    return set_mac_addr_f(net_dev, addr);
+    err = set_mac_addr_f(net_dev, addr);
+    if (!err)
+        /* cached headers have the old source MAC */
+        arp_hh_flush(net_dev);
+
+    return err;
 }
@@ -12,14 +12,16 @@
 #include "net/ether.h"
 #include "net/net.h"
 #include "net/nb_queue.h"
+#include "netinet/in.h"
 
-extern struct net_dev_s *curr_net_dev;
+extern struct net_dev_s *net_dev_list;
 
 #define NETDEV_RX_SUCCESS 0
 #define NETDEV_RX_DROP 1
 
 #define NET_XMIT_SUCCESS 0x00
-#define NET_XMIT_DROP    0x01
+#define NET_XMIT_DROP    0x01   // buffer dropped, tx queue is full
+#define NET_XMIT_CN      0x02   // buffer queued, but tx queue is congested
 #define NET_XMIT_MASK    0x0F
 
 #define NETDEV_TX_OK        0x00
@@ -32,6 +34,27 @@ extern struct net_dev_s *curr_net_dev;
 #define RX_RT_ALLMULTI  (1 << 3)    // receive broadcast & multicast & unicast frames filtering
 #define RX_RT_PROMISC   (1 << 4)    // receive all frames promiscuously
 
+/* Device transmit queue has a band for each priority (see NB_PRIO_*).
+ * Lengths of bands may be overridden at compile time */
+#define NETDEV_TX_BANDS 3
+#ifndef NETDEV_TX_QUEUE_LEN
+#define NETDEV_TX_QUEUE_LEN 4
+#endif
+#ifndef NETDEV_TX_CTRL_LEN
+#define NETDEV_TX_CTRL_LEN 2
+#endif
+#ifndef NETDEV_TX_NORMAL_LEN
+#define NETDEV_TX_NORMAL_LEN NETDEV_TX_QUEUE_LEN
+#endif
+#ifndef NETDEV_TX_BULK_LEN
+#define NETDEV_TX_BULK_LEN NETDEV_TX_QUEUE_LEN
+#endif
+
+/* Device features */
+#define NETDEV_F_SG (1 << 0)    // scatter-gather: device can transmit a chain of fragments
+#define NETDEV_F_RXCSUM (1 << 1)    // device verifies checksums of received frames (see CHECKSUM_HW)
+#define NETDEV_F_TXCSUM (1 << 2)    // device computes IPv4 header checksum, and TCP/UDP checksum of buffers marked CHECKSUM_HW
+
 struct net_dev_s;
 struct net_buff_s;
 
@@ -39,9 +62,34 @@ struct net_buff_s;
  * @param init Function for initialize a network device
  * @param open Function for change the state of net device to up
  * @param stop Function for change the state of net device to down
- * @param start_tx Function for transmit the packet
+ * @param start_tx Function for transmit the packet. When controller
+ *                 finishes the transmission, driver must call
+ *                 \a netdev_tx_complete() to start the next one.
+ *                 \a NETDEV_TX_BUSY may be returned only while tx is
+ *                 disallowed (see \a net_dev_tx_disallow()). May be
+ *                 called from interrupt, so it must not use the heap
+ *                 (buffer is released with \a free_net_buff()). If device has
+ *                 \a NETDEV_F_SG feature, the packet may have fragments
+ *                 (see \a nb_for_each_frag()) which must be streamed
+ *                 after the linear data. If device has
+ *                 \a NETDEV_F_TXCSUM feature, it must fill the IPv4
+ *                 header checksum, and the TCP/UDP checksum if
+ *                 \a ip_summed of packet is \a CHECKSUM_HW.
  * @param set_mac_addr Function for change the MAC address
  * @param set_dev_settings Set device settings
+ * @param irq_handler Interrupt handler. Received buffers must be passed
+ *                    to the stack with \a netif_rx(). If device has
+ *                    \a NETDEV_F_RXCSUM feature, \a ip_summed of buffer
+ *                    is set to \a CHECKSUM_HW only when the hardware has
+ *                    verified all checksums of the frame, IP header and
+ *                    the transport (\a CHECKSUM_NONE otherwise)
+ * @param poll Polling mode: process up to \p budget device events
+ *             (received frames, tx complete, link change) from the main
+ *             loop. Received buffers are passed to \a recv_pkt_handler().
+ *             Return number of processed frames; less than \p budget
+ *             means device is drained. If set, \a irq_handler is not used.
+ * @param irq_disable Mask the device interrupt (used with \a poll)
+ * @param irq_enable Unmask the device interrupt (used with \a poll)
  */
 struct net_dev_ops_s {
     int8_t (*init)(struct net_dev_s *net_dev);
@@ -52,28 +100,66 @@ struct net_dev_ops_s {
     int8_t (*set_mac_addr)(struct net_dev_s *net_dev, const void *addr);
     int8_t (*set_dev_settings)(struct net_dev_s *net_dev, bool full_duplex);
     void (*irq_handler)(struct net_dev_s *net_dev);
+    uint8_t (*poll)(struct net_dev_s *net_dev, uint8_t budget);
+    void (*irq_disable)(struct net_dev_s *net_dev);
+    void (*irq_enable)(struct net_dev_s *net_dev);
 };
 
-/* Operations for Layer 2 header */
+/*!
+ * @brief Operations for Layer 2 header
+ * @param create Push the header in front of the buffer data
+ * @param cache Build the header template (\a hard_hdr_len bytes) for
+ *              destination \p mac_d into \p hh. Template is copied in
+ *              front of the data instead of \a create (may be \a NULL)
+ */
 struct header_ops_s {
     int8_t (*create)(struct net_buff_s *net_buf, struct net_dev_s *net_dev,
                      int16_t type, const void *mac_d, const void *mac_s,
                      int16_t len);
+    int8_t (*cache)(const struct net_dev_s *net_dev, uint16_t type,
+                    const void *mac_d, uint8_t *hh);
     // int8_t (*parse)(const struct net_buff_s *net_buf, uint8_t *h_addr);
     // uint16_t (*parse_potocol)(const struct net_buff_s *net_buf);
 };
 
+/*!
+ * @brief Network device statistics. \a rx_dropped is also updated
+ * in interrupt (see \a netif_rx()), so it is changed with interrupts
+ * disabled
+ */
+struct net_dev_stats_s {
+    uint16_t rx_packets;    // frames passed to the stack
+    uint16_t tx_packets;    // frames handed to the controller
+    uint16_t rx_dropped;    // frames dropped by the stack (no memory/handler)
+    uint16_t tx_dropped;    // frames dropped before transmission
+};
+
 /*!
  * @brief Network device structure
+ * @param next Next device in the list of registered devices
  * @param flags State flags
  * @param netdev_ops Callbacks for control functions
  * @param header_ops Callbacks for eth header functions
+ * @param features Device features (e.g. NETDEV_F_SG)
  * @param mtu MTU (maximum transfer unit)
+ * @param hard_hdr_len Length of hardware header (headroom to reserve)
  * @param dev_addr Hardware address (MAC)
  * @param broadcast Hw broadcast Addr (MAC)
+ * @param tx_q Queues of buffers waiting for transmission, one per priority.
+ *             Buffers of a higher priority band are transmitted first
+ * @param xmit_lock Transmission from \a tx_q is in progress
+ * @param irq_hdlr Device interrupt is served (see \a irq_hdlr_add())
+ * @param poll_sched Polling of device is scheduled (device IRQ is masked)
+ * @param tx_done_cb Callback called when the frame transmission is
+ *                   completed (e.g. to refill the queue); may be \a NULL
+ * @param ip_addr IP address of interface (network byte order)
+ * @param ip_mask Netmask of the local subnet
+ * @param ip_gw Default gateway
+ * @param stats Statistics
  * @param priv pointer to device private data
  */
 typedef struct net_dev_s {
+    struct net_dev_s *next;
     struct {
         uint8_t up_state : 1;       // 1 - is running; 0 - is stopped
         uint8_t link_status : 1;    // 1 - Link is Up; 0 - Link is Down
@@ -83,12 +169,30 @@ typedef struct net_dev_s {
     } flags;
     const struct net_dev_ops_s *netdev_ops;
     const struct header_ops_s *header_ops;
+    uint8_t features;
     uint16_t mtu;
+    uint8_t hard_hdr_len;
     uint8_t dev_addr[6];    /** FIXME: ETH_MAC_LEN */
     uint8_t broadcast[6];
+    struct nb_queue_s tx_q[NETDEV_TX_BANDS];
+    volatile bool xmit_lock;
+    volatile bool irq_hdlr;
+    volatile bool poll_sched;
+    void (*tx_done_cb)(struct net_dev_s *net_dev);
+    in_addr_t ip_addr;
+    in_addr_t ip_mask;
+    in_addr_t ip_gw;
+    struct net_dev_stats_s stats;
     void *priv;
 } net_dev_t;
 
+/*!
+ * @brief Iterate over registered network devices
+ * @param ndev Device pointer to iterate
+ */
+#define net_dev_for_each(ndev)  \
+        for (ndev = net_dev_list; ndev; ndev = ndev->next)
+
 /*!
  * @brief Set Up State flag of network device to Runing
  */
@@ -167,7 +271,8 @@ static inline bool net_dev_xmit_complete(int8_t val) {
 }
 
 /*!
- * @brief Create Headre for network device
+ * @brief Create Headre for network device.
+ * Header is pushed in front of the buffer data.
  * @param net_buff Network Buffer
  * @param net_dev Network Device
  * @param type Type of packet
@@ -216,7 +321,11 @@ int8_t netdev_open(struct net_dev_s *net_dev);
 void netdev_close(struct net_dev_s *net_dev);
 void netdev_set_rx_mode(struct net_dev_s *net_dev);
 int8_t netdev_set_mac_addr(struct net_dev_s *net_dev, const void *addr);
+struct net_dev_s *netdev_get_by_inaddr(in_addr_t addr);
+struct net_dev_s *netdev_get_default(void);
 int8_t netdev_list_xmit(struct net_buff_s *net_buff);
 int8_t netdev_queue_xmit(struct nb_queue_s *queue);
+void netdev_tx_run(struct net_dev_s *net_dev);
+void netdev_tx_complete(struct net_dev_s *net_dev);
 
 #endif  /* !NET_NET_DEV_H */
@@ -5,8 +5,16 @@
 
 #include "net/net.h"
 
+/* Size of the receive ring. Must be a power of 2, not more than 128 */
+#ifndef NET_RX_RING_SIZE
+#define NET_RX_RING_SIZE 4
+#endif
+
+int8_t netif_rx(struct net_buff_s *net_buff);
+uint8_t net_rx_poll(uint8_t budget);
 int8_t recv_pkt_handler(struct net_buff_s *net_buff);
 void pkt_hdlr_add(uint16_t type, proto_hdlr_t handler);
+proto_hdlr_t pkt_hdlr_get(uint16_t type);
 void pkt_hdlr_del(uint16_t type);
 
 #endif  /* !NET_PKT_HANDLER_H */
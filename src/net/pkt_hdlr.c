@@ -1,9 +1,15 @@
+#include <util/atomic.h>
+
 #include <stdint.h>
+#include <stdbool.h>
 
 #include "net/net.h"
+#include "net/net_dev.h"
 #include "net/ether.h"
 #include "net/pkt_handler.h"
+#include "net/interrupt.h"
 #include "arpa/inet.h"
+#include "netinet/arp.h"
 
 /*!
  * @brief Handlers for specific protocols.
@@ -18,12 +24,89 @@ static struct recv_pkt_hdlr_ops_s recv_ops = {
     .eth_arp = NULL,
 };
 
+_Static_assert(!(NET_RX_RING_SIZE & (NET_RX_RING_SIZE - 1)) &&
+               (NET_RX_RING_SIZE <= 128),
+               "NET_RX_RING_SIZE must be a power of 2, not more than 128");
+
+/*!
+ * @brief Receive ring. Producers (ISRs of devices, poll contexts) -
+ * single consumer (main loop). \a rx_ring_head is written only by
+ * producers, which are serialized with interrupts disabled, so the ISRs
+ * of several devices and the main loop may produce. \a rx_ring_tail is
+ * written only by consumer, so consumer needs no locking.
+ */
+static struct net_buff_s *volatile rx_ring[NET_RX_RING_SIZE];
+static volatile uint8_t rx_ring_head = 0;
+static volatile uint8_t rx_ring_tail = 0;
+
+/*!
+ * @brief Queue the received buffer for processing by the stack.
+ * Called by device driver (usually from the interrupt handler; several
+ * devices may call it), the buffer is processed later in \a net_rx_poll().
+ * @param net_buff Received buffer
+ * @return 0 if success; 1 if drop
+ */
+int8_t netif_rx(struct net_buff_s *net_buff) {
+    bool full;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        uint8_t head = rx_ring_head;
+
+        full = ((uint8_t)(head - rx_ring_tail) >= NET_RX_RING_SIZE);
+        if (!full) {
+            rx_ring[head & (NET_RX_RING_SIZE - 1)] = net_buff;
+            rx_ring_head = head + 1;
+        } else {
+            net_buff->net_dev->stats.rx_dropped++;
+        }
+    }
+
+    if (full) {
+        free_net_buff(net_buff);
+        return NETDEV_RX_DROP;
+    }
+
+    return NETDEV_RX_SUCCESS;
+}
+
+/*!
+ * @brief Process the received buffers, poll the device scheduled
+ * by interrupt, run the protocol timers and free the heap blocks
+ * released in interrupt.
+ * It needs to be called from the main loop.
+ * @param budget Max. number of buffers to process
+ * @return Number of processed buffers
+ */
+uint8_t net_rx_poll(uint8_t budget) {
+    uint8_t tail = rx_ring_tail;
+    uint8_t done = 0;
+
+    while ((done < budget) && (tail != rx_ring_head)) {
+        struct net_buff_s *nb = rx_ring[tail & (NET_RX_RING_SIZE - 1)];
+
+        rx_ring_tail = ++tail;
+        recv_pkt_handler(nb);
+        done++;
+    }
+
+    done += net_dev_poll(budget - done);
+
+    arp_timer();
+    nb_heap_collect();
+
+    return done;
+}
+
 /*!
  * @brief Received Packet Handler
  * @param net_buff Pointer to receive net buffer
  * @return 0 if success; 1 if drop
  */
 int8_t recv_pkt_handler(struct net_buff_s *net_buff) {
+    struct net_dev_s *ndev = net_buff->net_dev;
+
+    ndev->stats.rx_packets++;
+
     switch (net_buff->protocol) {
         case htons(ETH_P_IP):
             if (recv_ops.eth_ip) {
@@ -40,6 +123,10 @@ int8_t recv_pkt_handler(struct net_buff_s *net_buff) {
         default:
             break;
     }
+    /* counter is also updated by netif_rx() in interrupt */
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        ndev->stats.rx_dropped++;
+    }
     free_net_buff(net_buff);
 
     return NETDEV_RX_DROP;  // No Handler, packet drop
@@ -65,6 +152,24 @@ void pkt_hdlr_add(uint16_t type, proto_hdlr_t handler) {
     }
 }
 
+/*!
+ * @brief Get Packet Handler
+ * @param type Packet type (e.g. ETH_P_IP)
+ * @return Handler function for this type or \a NULL if not set
+ */
+proto_hdlr_t pkt_hdlr_get(uint16_t type) {
+    switch (type) {
+        case ETH_P_IP:
+            return recv_ops.eth_ip;
+
+        case ETH_P_ARP:
+            return recv_ops.eth_arp;
+
+        default:
+            return NULL;
+    }
+}
+
 /*!
  * @brief Remove Packet Handler
  * @param type Packet type (e.g. ETH_P_IP)
@@ -15,7 +15,7 @@ extern void nb_queue_clear(struct nb_queue_s *q);
 struct socket *socket_list;
 
 void socket_list_init(void) {
-    socket_list->next = socket_list->prev = NULL;
+    socket_list = NULL;
 }
 
 /*!
@@ -53,6 +53,177 @@ static void socket_list_del(struct socket *entry) {
 #define socket_list_for_each(i)   \
         for (i = socket_list; i; i = i->next)
 
+_Static_assert(!(SK_HTABLE_SIZE & (SK_HTABLE_SIZE - 1)) &&
+               (SK_HTABLE_SIZE <= 256),
+               "SK_HTABLE_SIZE must be a power of 2, not more than 256");
+
+/*!
+ * @brief Lookup table of bound sockets. Connected socket is hashed by
+ * its 4-tuple, others by the local pair with zero remote pair (wildcard).
+ * Chains are linked through \a hnext
+ */
+static struct socket *sk_htable[SK_HTABLE_SIZE];
+
+/*!
+ * @brief Hash of the 4-tuple. All values are in network byte order
+ * @param proto Protocol (e.g. IPPROTO_UDP)
+ * @param laddr Local address
+ * @param lport Local port
+ * @param raddr Remote address or zero
+ * @param rport Remote port or zero
+ * @return Bucket index
+ */
+static inline uint8_t sk_hashfn(uint8_t proto,
+                                in_addr_t laddr, in_port_t lport,
+                                in_addr_t raddr, in_port_t rport) {
+    uint32_t h = laddr ^ raddr ^ (((uint32_t)lport << 16) | rport) ^ proto;
+
+    h ^= h >> 16;
+    h ^= h >> 8;
+
+    return h & (SK_HTABLE_SIZE - 1);
+}
+
+/*!
+ * @brief Check that the socket is connected to the remote pair
+ */
+static inline bool sk_is_connected(const struct socket *sk) {
+    return sk->state == SS_CONNECTED;
+}
+
+/*!
+ * @brief Add bound socket to the lookup table. Connected socket
+ * is added with the remote pair
+ * @param sk Socket with local address and port
+ * @return 0 if success; -1 if the same tuple is already in use
+ */
+int8_t sk_hash_add(struct socket *sk) {
+    struct socket *s;
+    in_addr_t raddr = 0;
+    in_port_t rport = 0;
+
+    if (sk_is_connected(sk)) {
+        raddr = sk->dst_addr;
+        rport = sk->dst_port;
+    }
+    sk->sk_hash = sk_hashfn(sk->protocol, sk->src_addr, sk->src_port,
+                            raddr, rport);
+
+    for (s = sk_htable[sk->sk_hash]; s; s = s->hnext) {
+        if ((s->protocol == sk->protocol) &&
+            (s->src_port == sk->src_port) && (s->src_addr == sk->src_addr) &&
+            (sk_is_connected(s) == sk_is_connected(sk)) &&
+            (!sk_is_connected(s) || (s->port_pair == sk->port_pair &&
+                                     s->addr_pair == sk->addr_pair)))
+            // EADDRINUSE
+            return -1;
+    }
+
+    sk->hnext = sk_htable[sk->sk_hash];
+    sk_htable[sk->sk_hash] = sk;
+
+    return 0;
+}
+
+/*!
+ * @brief Remove socket from the lookup table, if it is there
+ * @param sk Socket
+ */
+void sk_hash_del(struct socket *sk) {
+    struct socket **pp = &sk_htable[(uint8_t)sk->sk_hash];
+
+    for (; *pp; pp = &(*pp)->hnext) {
+        if (*pp == sk) {
+            *pp = sk->hnext;
+            break;
+        }
+    }
+    sk->hnext = NULL;
+}
+
+/*!
+ * @brief Check that the unconnected socket is bound to the local pair.
+ * Socket bound to any address matches any \p daddr
+ */
+static inline bool sk_match_bound(const struct socket *sk, uint8_t proto,
+                                  in_addr_t daddr, in_port_t dport) {
+    return ((sk->protocol == proto) && !sk_is_connected(sk) &&
+            (sk->src_port == dport) &&
+            (!sk->src_addr || (sk->src_addr == daddr)));
+}
+
+/*!
+ * @brief Find the socket for received unicast packet: connected to
+ * the source, then bound to the destination address, then bound
+ * to any address. All values are in network byte order
+ * @param proto Protocol (e.g. IPPROTO_UDP)
+ * @param saddr Source (remote) address
+ * @param sport Source (remote) port
+ * @param daddr Destination (local) address
+ * @param dport Destination (local) port
+ * @return Socket or \a NULL if not found
+ */
+struct socket *sk_lookup(uint8_t proto, in_addr_t saddr, in_port_t sport,
+                         in_addr_t daddr, in_port_t dport) {
+    struct socket *sk;
+
+    sk = sk_htable[sk_hashfn(proto, daddr, dport, saddr, sport)];
+    for (; sk; sk = sk->hnext) {
+        if ((sk->protocol == proto) && sk_is_connected(sk) &&
+            (sk->src_port == dport) && (sk->src_addr == daddr) &&
+            (sk->dst_port == sport) && (sk->dst_addr == saddr))
+            return sk;
+    }
+
+    sk = sk_htable[sk_hashfn(proto, daddr, dport, 0, 0)];
+    for (; sk; sk = sk->hnext) {
+        if (sk_match_bound(sk, proto, daddr, dport) && sk->src_addr)
+            return sk;
+    }
+
+    sk = sk_htable[sk_hashfn(proto, INADDR_ANY, dport, 0, 0)];
+    for (; sk; sk = sk->hnext) {
+        if (sk_match_bound(sk, proto, daddr, dport) && !sk->src_addr)
+            return sk;
+    }
+
+    return NULL;
+}
+
+/*!
+ * @brief Iterate over unconnected sockets bound to the local pair
+ * (e.g. to deliver broadcast). Socket bound to any address matches too
+ * @param sk Previous found socket or \a NULL to start
+ * @param proto Protocol (e.g. IPPROTO_UDP)
+ * @param daddr Destination (local) address
+ * @param dport Destination (local) port
+ * @return Next socket or \a NULL if no more
+ */
+struct socket *sk_lookup_bound(struct socket *sk, uint8_t proto,
+                               in_addr_t daddr, in_port_t dport) {
+    uint8_t b_any = sk_hashfn(proto, INADDR_ANY, dport, 0, 0);
+    uint8_t b;
+
+    if (sk) {
+        b = sk->sk_hash;
+        sk = sk->hnext;
+    } else {
+        b = sk_hashfn(proto, daddr, dport, 0, 0);
+        sk = sk_htable[b];
+    }
+
+    for (;;) {
+        for (; sk; sk = sk->hnext) {
+            if (sk_match_bound(sk, proto, daddr, dport))
+                return sk;
+        }
+        if (b == b_any)
+            return NULL;
+        b = b_any;
+        sk = sk_htable[b];
+    }
+}
+
 /*!
  * @brief Used on \a server side. Accepts a received incoming attempt
  * to create a new TCP connection from the remote client, and creates
@@ -86,6 +257,13 @@ int8_t bind(struct socket *sk,
         bind_f = pgm_read_ptr(&sk->p_ops->bind);
         if (bind_f)
             err = bind_f(sk, addr, addr_len);   // bind()
+
+        if (!err && sk_hash_add(sk)) {
+            // EADDRINUSE
+            sk->src_addr = 0;
+            sk->src_port = 0;
+            err = -1;
+        }
     }
     return err;
 }
@@ -102,8 +280,30 @@ int8_t bind(struct socket *sk,
 int8_t connect(struct socket *sk,
                const struct sockaddr *addr,
                socklen_t addr_len) {
+    int8_t (*connect_f)(struct socket *, const struct sockaddr *, uint8_t);
+    int8_t err = -1;
 
-    return 0;
+    if (!sk)
+        // ENOTSOCK
+        return -1;
+
+    connect_f = pgm_read_ptr(&sk->p_ops->connect);
+    if (!connect_f)
+        // EOPNOTSUPP
+        return -1;
+
+    /* socket is rehashed with the remote pair */
+    sk_hash_del(sk);
+    err = connect_f(sk, addr, addr_len);    // connect()
+
+    if (sk->src_port && sk_hash_add(sk)) {
+        // EADDRINUSE
+        sk->state = SS_UNCONNECTED;
+        sk_hash_add(sk);
+        err = -1;
+    }
+
+    return err;
 }
 
 /*!
@@ -147,6 +347,7 @@ ssize_t recv(struct socket *restrict sk,
  * @param addr Pointer to socket address structure
  * @param addr_len Length of \p addr
  * @return Number of received bytes or -1 for error
+ *         (or if there is no data)
  */
 ssize_t recvfrom(struct socket *restrict sk,
                  void *restrict buff,
@@ -154,8 +355,113 @@ ssize_t recvfrom(struct socket *restrict sk,
                  uint8_t flags,
                  struct sockaddr *restrict addr,
                  socklen_t *restrict addr_len) {
+    ssize_t (*rcv_msg_f)(struct socket *, struct msghdr *, size_t, uint8_t);
+    ssize_t ret;
+    struct msghdr msg;
+    struct iovec iov;
 
-    return 0;
+    if (!sk) {
+        // ENOTSOCK
+        return -1;
+    }
+
+    rcv_msg_f = pgm_read_ptr(&sk->p_ops->recvmsg);
+    if (!rcv_msg_f)
+        // EOPNOTSUPP
+        return -1;
+
+    iovec_import(&iov, buff, buff_size);
+
+    msg.msg_name = NULL;
+    msg.msg_namelen = 0;
+    msg.msg_flags = 0;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+
+    if (addr && addr_len) {
+        msg.msg_name = addr;
+        msg.msg_namelen = *addr_len;
+    }
+
+    ret = rcv_msg_f(sk, &msg, buff_size, flags);    // recvmsg()
+
+    if ((ret >= 0) && addr && addr_len)
+        *addr_len = msg.msg_namelen;
+
+    return ret;
+}
+
+/*!
+ * @brief Receive without copying: the next datagram is lent to the
+ * application in place, so it is not stored twice in RAM. The data
+ * must not be modified and must be given back with \a recv_zc_release()
+ * as soon as possible, as the buffer is not available to the stack
+ * until then. If \p addr is not \c NULL, it is filled like
+ * in \a recvfrom()
+ * @param sk Pointer to socket
+ * @param view View to fill
+ * @param flags Flags (MSG_PEEK)
+ * @param addr Pointer to socket address structure
+ * @param addr_len Length of \p addr
+ * @return Length of data or -1 for error (or if there is no data)
+ */
+ssize_t recvfrom_zc(struct socket *restrict sk,
+                    struct sock_rx_view *restrict view,
+                    uint8_t flags,
+                    struct sockaddr *restrict addr,
+                    socklen_t *restrict addr_len) {
+    ssize_t (*rcv_zc_f)(struct socket *, struct msghdr *,
+                        struct net_buff_s **, uint8_t);
+    struct net_buff_s *nb;
+    struct msghdr msg;
+    ssize_t ret;
+
+    if (!sk || !view) {
+        // ENOTSOCK
+        return -1;
+    }
+
+    rcv_zc_f = pgm_read_ptr(&sk->p_ops->recv_zc);
+    if (!rcv_zc_f)
+        // EOPNOTSUPP
+        return -1;
+
+    msg.msg_name = NULL;
+    msg.msg_namelen = 0;
+    msg.msg_flags = 0;
+    msg.msg_iov = NULL;
+    msg.msg_iovlen = 0;
+
+    if (addr && addr_len) {
+        msg.msg_name = addr;
+        msg.msg_namelen = *addr_len;
+    }
+
+    ret = rcv_zc_f(sk, &msg, &nb, flags);   // recv_zc()
+    if (ret < 0)
+        return ret;
+
+    view->data = nb_data(nb);
+    view->len = ret;
+    view->nb = nb;
+
+    if (addr && addr_len)
+        *addr_len = msg.msg_namelen;
+
+    return ret;
+}
+
+/*!
+ * @brief Give back the data lent by \a recvfrom_zc()
+ * @param view View of data
+ */
+void recv_zc_release(struct sock_rx_view *view) {
+    if (view->nb)
+        free_net_buff(view->nb);
+
+    view->nb = NULL;
+    view->data = NULL;
+    view->len = 0;
 }
 
 /*!
@@ -206,6 +512,7 @@ ssize_t sendto(struct socket *sk,
     msg.msg_namelen = 0;
     msg.msg_flags = flags;
     msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
 
     if (addr) {
         msg.msg_name = (void *)addr;
@@ -218,12 +525,84 @@ ssize_t sendto(struct socket *sk,
     return ret;
 }
 
+/*!
+ * @brief First phase of send without copying: allocate the outgoing
+ * buffer and lend its data area, so the application builds the payload
+ * right in the frame. Headers are added by \a sock_commit_send().
+ * Destination is the connected peer (see \a connect()) or
+ * the last one used with \a sendto(). Uncommitted buffer
+ * of previous call is dropped
+ * @param sk Pointer to socket
+ * @param len Max. length of data. Datagram must fit in the MTU
+ * of output device, it is not fragmented
+ * @return Pointer to data area or \a NULL if error
+ */
+void *sock_alloc_send_buf(struct socket *sk, uint16_t len) {
+    struct net_buff_s *(*alloc_f)(struct socket *, uint16_t);
+
+    if (!sk)
+        // ENOTSOCK
+        return NULL;
+
+    alloc_f = pgm_read_ptr(&sk->p_ops->alloc_send);
+    if (!alloc_f)
+        // EOPNOTSUPP
+        return NULL;
+
+    if (sk->tx_nb) {
+        free_net_buff(sk->tx_nb);
+        sk->tx_nb = NULL;
+    }
+
+    sk->tx_nb = alloc_f(sk, len);   // alloc_send()
+    if (!sk->tx_nb)
+        return NULL;
+
+    return nb_data(sk->tx_nb);
+}
+
+/*!
+ * @brief Second phase of send without copying: build the headers
+ * in front of the data filled by application and transmit
+ * @param sk Pointer to socket
+ * @param len Length of filled data, not more than allocated
+ * @return Number of sending bytes or -1 for error
+ */
+ssize_t sock_commit_send(struct socket *sk, uint16_t len) {
+    ssize_t (*commit_f)(struct socket *, struct net_buff_s *);
+    struct net_buff_s *nb;
+
+    if (!sk || !sk->tx_nb)
+        // EINVAL
+        return -1;
+
+    nb = sk->tx_nb;
+    sk->tx_nb = NULL;
+
+    if (len > nb_len(nb)) {
+        // EMSGSIZE
+        free_net_buff(nb);
+        return -1;
+    }
+    trim_net_buff(nb, len);
+
+    commit_f = pgm_read_ptr(&sk->p_ops->commit_send);
+    if (!commit_f) {
+        // EOPNOTSUPP
+        free_net_buff(nb);
+        return -1;
+    }
+
+    return commit_f(sk, nb);    // commit_send()
+}
+
 /*!
  * @brief BSD sendmsg interface
  * @param sk Socket
  * @param message Points to a msghdr structure, containing both the destination
  * address and the buffers for the outgoing message. The length and format of
- * the address depend on the address family of the socket.
+ * the address depend on the address family of the socket. Data of all
+ * msg_iovlen elements of msg_iov is gathered into one message.
  * The msg_flags member is ignored.
  * @param flags Specifies the type of message transmission.
  * The application may specify 0 or the following flag:
@@ -241,16 +620,84 @@ ssize_t sendmsg(struct socket *sk,
                 const struct msghdr *message,
                 uint8_t flags) {
     ssize_t ret = -1;
+    ssize_t (*snd_msg_f)(struct socket *, struct msghdr *);
+    struct msghdr msg;
+
+    if (!sk) {
+        // ENOTSOCK
+        return -1;
+    }
 
-    /** TODO: */
+    if (!message || (message->msg_iovlen && !message->msg_iov))
+        // EINVAL
+        return -1;
+
+    /* the caller's header is const and its msg_flags is ignored */
+    msg = *message;
+    msg.msg_flags = flags;
 
-    ssize_t (*snd_msg_f)(struct socket *, struct msghdr *);
     snd_msg_f = pgm_read_ptr(&sk->p_ops->sendmsg);
-    ret = snd_msg_f(sk, (void *)message);  // sendmsg()
+    ret = snd_msg_f(sk, &msg);  // sendmsg()
 
     return ret;
 }
 
+/*!
+ * @brief Set option of socket level (SOL_SOCKET)
+ * @param sk Pointer to socket
+ * @param optname Option name (e.g. SO_NO_CHECK)
+ * @param optval Pointer to option value
+ * @param optlen Length of \p optval
+ * @return 0 on success
+ */
+static int8_t sock_setsockopt(struct socket *sk, uint8_t optname,
+                              const void *optval, socklen_t optlen) {
+    int8_t err = -1;    // ENOPROTOOPT
+
+    if (!optlen)
+        // EINVAL
+        return -1;
+
+    switch (optname) {
+        case SO_NO_CHECK:
+            /* value may be passed as int or as byte */
+            sk->no_check = !!*(const uint8_t *)optval;
+            err = 0;
+            break;
+
+        default:
+            break;
+    }
+
+    return err;
+}
+
+/*!
+ * @brief Set option \p optname at protocol \p level of socket \p sk
+ * @param sk Pointer to socket
+ * @param level Protocol level of option (e.g. IPPROTO_IP or SOL_SOCKET)
+ * @param optname Option name (e.g. IP_TOS)
+ * @param optval Pointer to option value
+ * @param optlen Length of \p optval
+ * @return 0 on success
+ */
+int8_t setsockopt(struct socket *sk, uint8_t level, uint8_t optname,
+                  const void *optval, socklen_t optlen) {
+    int8_t (*sso_f)(struct socket *, uint8_t, uint8_t, const void *, uint8_t);
+    int8_t err = -1;
+
+    if (sk && optval) {
+        if (level == SOL_SOCKET)
+            return sock_setsockopt(sk, optname, optval, optlen);
+
+        sso_f = pgm_read_ptr(&sk->p_ops->setsockopt);
+        if (sso_f)
+            err = sso_f(sk, level, optname, optval, optlen);    // setsockopt()
+        // else ENOPROTOOPT
+    }
+    return err;
+}
+
 /*!
  * @brief Shut down all or part of the connection open on socket FD
  * @param sk Pointer to socket
@@ -349,6 +796,11 @@ void sock_close(struct socket **sk) {
             release_f(*sk); // release()
         (*sk)->p_ops = NULL;
     }
+    sk_hash_del(*sk);
+
+    if ((*sk)->tx_nb)
+        free_net_buff((*sk)->tx_nb);
+
     // clear queues
     nb_queue_clear(&(*sk)->nb_tx_q);
     nb_queue_clear(&(*sk)->nb_rx_q);
@@ -5,6 +5,8 @@
 #ifndef NET_SOCKET_H
 #define NET_SOCKET_H
 
+#include <avr/io.h>
+
 #include <stdint.h>
 #include <stddef.h>
 
@@ -46,6 +48,22 @@
 #define MSG_TRUNC 64        // Normal data truncated
 #define MSG_WAITALL 128     // Attempt to fill the read buffer
 
+/* Level of socket options */
+#define SOL_SOCKET 1
+
+/* Options for level SOL_SOCKET */
+#define SO_NO_CHECK 11      // Skip UDP checksum on transmit and on unicast receive (int)
+
+/* Number of socket lookup hash buckets, power of 2, not more than 256.
+ * May be overridden at compile time */
+#ifndef SK_HTABLE_SIZE
+#if defined(RAMEND) && (RAMEND < 0x1000)    // 2 KB of SRAM
+#define SK_HTABLE_SIZE 4
+#else
+#define SK_HTABLE_SIZE 16
+#endif
+#endif
+
 typedef uint8_t socklen_t;
 typedef uint8_t sa_family_t;
 
@@ -70,7 +88,8 @@ struct sockaddr_storage {
 struct msghdr {
     void *msg_name;         // ptr to socket address structure
     socklen_t msg_namelen;  // size of socket address structure
-    struct iovec *msg_iov;  // data
+    struct iovec *msg_iov;  // data: array of I/O vectors
+    uint8_t msg_iovlen;     // number of elements in msg_iov
     uint8_t msg_flags;      // flags on received message
 };
 
@@ -93,18 +112,42 @@ struct socket {
             in_port_t src_port; // source port
         };
     };
-    uint32_t sk_hash;   // port-addr hash used for lookup
+    uint32_t sk_hash;   // lookup hash bucket of 4-tuple (or of local pair)
 
     uint8_t protocol;
+    uint8_t tos;        // IP type of service for outgoing packets
+    uint8_t no_check : 1;   // UDP checksum is skipped (SO_NO_CHECK)
 
     struct nb_queue_s nb_tx_q;  // transmit queue
     struct nb_queue_s nb_rx_q;  // receive queue
+    struct net_buff_s *tx_nb;   // buffer filled by application (see sock_alloc_send_buf())
 
     struct socket *prev,    // prev socket in list
                   *next;    // next socket in list
+    struct socket *hnext;   // next socket in lookup hash chain
+};
+
+/*!
+ * @brief Received data lent to the application by \a recvfrom_zc().
+ * Data stays in the network buffer and must be given back
+ * with \a recv_zc_release()
+ * @param data Pointer to data (read-only)
+ * @param len Length of data
+ * @param nb Lent buffer
+ */
+struct sock_rx_view {
+    const uint8_t *data;
+    uint16_t len;
+    struct net_buff_s *nb;
 };
 
 void socket_list_init(void);
+int8_t sk_hash_add(struct socket *sk);
+void sk_hash_del(struct socket *sk);
+struct socket *sk_lookup(uint8_t proto, in_addr_t saddr, in_port_t sport,
+                         in_addr_t daddr, in_port_t dport);
+struct socket *sk_lookup_bound(struct socket *sk, uint8_t proto,
+                               in_addr_t daddr, in_port_t dport);
 
 struct socket *accept(struct socket *restrict sk,
                       struct sockaddr *restrict addr,
@@ -126,6 +169,14 @@ ssize_t recvfrom(struct socket *restrict sk,
                  uint8_t flags,
                  struct sockaddr *restrict addr,
                  socklen_t *restrict addr_len);
+ssize_t recvfrom_zc(struct socket *restrict sk,
+                    struct sock_rx_view *restrict view,
+                    uint8_t flags,
+                    struct sockaddr *restrict addr,
+                    socklen_t *restrict addr_len);
+void recv_zc_release(struct sock_rx_view *view);
+void *sock_alloc_send_buf(struct socket *sk, uint16_t len);
+ssize_t sock_commit_send(struct socket *sk, uint16_t len);
 ssize_t send(struct socket *sk, const void *buff,
              size_t buff_size, uint8_t flags);
 ssize_t sendto(struct socket *sk,
@@ -137,6 +188,8 @@ ssize_t sendto(struct socket *sk,
 ssize_t sendmsg(struct socket *sk,
                 const struct msghdr *message,
                 uint8_t flags);
+int8_t setsockopt(struct socket *sk, uint8_t level, uint8_t optname,
+                  const void *optval, socklen_t optlen);
 int8_t shutdown(struct socket *sk, uint8_t how);
 struct socket *socket(uint8_t family, uint8_t type, uint8_t protocol);
 void sock_close(struct socket **sk);
@@ -2,6 +2,7 @@
 #define NET_UIO_H
 
 #include <stddef.h>
+#include <stdint.h>
 
 struct iovec {
     void *iov_base;     // Base address of a memory region for input or output. 
@@ -13,4 +14,19 @@ static inline void iovec_import(struct iovec *iov, void *buf, size_t len) {
     iov->iov_len = len;
 }
 
+/*!
+ * @brief Get the total length of I/O vectors
+ * @param iov Array of I/O vectors
+ * @param iovlen Number of elements in \p iov
+ * @return Sum of lengths
+ */
+static inline size_t iov_length(const struct iovec *iov, uint8_t iovlen) {
+    size_t len = 0;
+
+    while (iovlen--)
+        len += iov++->iov_len;
+
+    return len;
+}
+
 #endif  /* !NET_UIO_H */
@@ -88,19 +88,124 @@ static int8_t inet_bind(struct socket *sk,
         }
     }
 
+    /* already bound */
     if (sk->src_port)
-        /** TODO: get port number automaticly */
         goto out;
 
     sk->src_addr = addr_in->sin_addr.s_addr;
     sk->dst_addr = 0;
-    sk->src_port = htons(addr_in->sin_port);
+    /* port is in network byte order; zero selects a free one */
+    sk->src_port = addr_in->sin_port ? addr_in->sin_port : inet_get_port();
     sk->dst_port = 0;
     err = 0;
 out:
     return err;
 }
 
+/*!
+ * @brief Connect datagram socket: set the default destination and
+ * receive datagrams only from it. Unbound socket is bound to a free
+ * port and to the address of output interface.
+ * Family \a AF_UNSPEC dissolves the association
+ * @param sk Socket
+ * @param addr Remote address
+ * @param addr_len Length of \p addr
+ * @return 0 on success
+ */
+static int8_t inet_dgram_connect(struct socket *sk,
+                                 const struct sockaddr *addr,
+                                 uint8_t addr_len) {
+    const struct sockaddr_in *addr_in = (const struct sockaddr_in *)addr;
+
+    if (addr_len < sizeof(struct sockaddr_in))
+        // EINVAL
+        return -1;
+
+    if (addr_in->sin_family == AF_UNSPEC) {
+        sk->dst_addr = 0;
+        sk->dst_port = 0;
+        sk->state = SS_UNCONNECTED;
+        return 0;
+    }
+    if (addr_in->sin_family != AF_INET)
+        // EAFNOSUPPORT
+        return -1;
+    if (!addr_in->sin_port)
+        // EINVAL
+        return -1;
+
+    sk->dst_addr = addr_in->sin_addr.s_addr;
+    sk->dst_port = addr_in->sin_port;
+
+    if (!sk->src_addr) {
+        sk->src_addr = ip_select_saddr(sk);
+        if (!sk->src_addr)
+            // ENETUNREACH
+            return -1;
+    }
+    if (!sk->src_port)
+        sk->src_port = inet_get_port();
+
+    sk->state = SS_CONNECTED;
+
+    return 0;
+}
+
+/*!
+ * @brief Set option of Internet Protocol socket
+ * @param sk Socket
+ * @param level Protocol level of option
+ * @param optname Option name (e.g. IP_TOS)
+ * @param optval Pointer to option value
+ * @param optlen Length of \p optval
+ * @return 0 on success
+ */
+static int8_t inet_setsockopt(struct socket *sk, uint8_t level,
+                              uint8_t optname, const void *optval,
+                              uint8_t optlen) {
+    int8_t err = -1;    // ENOPROTOOPT
+
+    if (level != IPPROTO_IP)
+        goto out;
+
+    switch (optname) {
+        case IP_TOS:
+            if (!optlen) {
+                // EINVAL
+                goto out;
+            }
+            /* value may be passed as int or as byte */
+            sk->tos = *(const uint8_t *)optval;
+            err = 0;
+            break;
+
+        default:
+            break;
+    }
+out:
+    return err;
+}
+
+/*!
+ * @brief Bind unbound socket to a free port before sending,
+ * so the replies can be received
+ * @param sk Socket
+ * @return 0 on success
+ */
+static int8_t inet_autobind(struct socket *sk) {
+    if (sk->src_port)
+        return 0;
+
+    sk->src_port = inet_get_port();
+    if (sk_hash_add(sk)) {
+        // EADDRINUSE
+        sk->src_port = 0;
+        return -1;
+    }
+
+    return 0;
+}
+
 /*!
  * @brief Sending message over Internet Protocol
  * @param sk Socket
@@ -108,8 +213,8 @@ out:
  */
 static ssize_t inet_sendmsg(struct socket *restrict sk,
                             struct msghdr *restrict msg) {
-    if (!sk->src_port)
-        sk->src_port = inet_get_port();
+    if (inet_autobind(sk))
+        return -1;
 
     switch (sk->protocol) {
         case IPPROTO_TCP:
@@ -127,6 +232,86 @@ static ssize_t inet_sendmsg(struct socket *restrict sk,
     }
 }
 
+/*!
+ * @brief Receiving message over Internet Protocol
+ * @param sk Socket
+ * @param msg Message structure
+ * @param len Size of receive buffer
+ * @param flags Flags (e.g. MSG_PEEK)
+ * @return Number of received bytes or -1 for error
+ */
+static ssize_t inet_recvmsg(struct socket *restrict sk,
+                            struct msghdr *restrict msg,
+                            size_t len, uint8_t flags) {
+    switch (sk->protocol) {
+        case IPPROTO_UDP:
+            return udp_recv_msg(sk, msg, len, flags);
+
+        default:
+            // EOPNOTSUPP
+            return -1;
+    }
+}
+
+/*!
+ * @brief Receiving message over Internet Protocol without copying
+ * @param sk Socket
+ * @param msg Message structure (without data)
+ * @param nb Pointer to store the lent buffer
+ * @param flags Flags (e.g. MSG_PEEK)
+ * @return Length of data or -1 for error
+ */
+static ssize_t inet_recv_zc(struct socket *restrict sk,
+                            struct msghdr *restrict msg,
+                            struct net_buff_s **nb, uint8_t flags) {
+    switch (sk->protocol) {
+        case IPPROTO_UDP:
+            return udp_recv_zc(sk, msg, nb, flags);
+
+        default:
+            // EOPNOTSUPP
+            return -1;
+    }
+}
+
+/*!
+ * @brief Allocate the buffer to be filled in place by application
+ * @param sk Socket
+ * @param len Length of data
+ * @return Buffer or \a NULL if error
+ */
+static struct net_buff_s *inet_alloc_send(struct socket *sk, uint16_t len) {
+    if (inet_autobind(sk))
+        return NULL;
+
+    switch (sk->protocol) {
+        case IPPROTO_UDP:
+            return udp_alloc_send(sk, len);
+
+        default:
+            // EOPNOTSUPP
+            return NULL;
+    }
+}
+
+/*!
+ * @brief Send the buffer filled in place by application
+ * @param sk Socket
+ * @param nb Buffer from \a inet_alloc_send()
+ * @return Number of sending bytes or -1 for error
+ */
+static ssize_t inet_commit_send(struct socket *sk, struct net_buff_s *nb) {
+    switch (sk->protocol) {
+        case IPPROTO_UDP:
+            return udp_commit_send(sk, nb);
+
+        default:
+            // theoretically impossible, but still...
+            free_net_buff(nb);
+            return -1;
+    }
+}
+
 /** TODO: */
 static const struct protocol_ops inet_stream_ops PROGMEM = {
     .release = inet_release,
@@ -135,8 +320,12 @@ static const struct protocol_ops inet_stream_ops PROGMEM = {
     .bind = inet_bind,
     .connect = NULL,
     .listen = NULL,
+    .setsockopt = inet_setsockopt,
     .sendmsg = inet_sendmsg,
     .recvmsg = NULL,
+    .recv_zc = NULL,
+    .alloc_send = NULL,
+    .commit_send = NULL,
 };
 
 /** TODO: */
@@ -145,10 +334,14 @@ static const struct protocol_ops inet_dgram_ops PROGMEM = {
     .shutdown = inet_shutdown,
     .accept = NULL,
     .bind = inet_bind,
-    .connect = NULL,
+    .connect = inet_dgram_connect,
     .listen = NULL,
+    .setsockopt = inet_setsockopt,
     .sendmsg = inet_sendmsg,
-    .recvmsg = NULL,
+    .recvmsg = inet_recvmsg,
+    .recv_zc = inet_recv_zc,
+    .alloc_send = inet_alloc_send,
+    .commit_send = inet_commit_send,
 };
 
 /*!
@@ -5,35 +5,464 @@
 #include "net/net_dev.h"
 #include "net/ether.h"
 #include "net/pkt_handler.h"
-#include "net/ipconfig.h"
 #include "arpa/inet.h"
 #include "netinet/arp.h"
 #include "netinet/ip.h"
 
-struct arp_tbl_entry_s arp_tbl;
+_Static_assert((ARP_TBL_SIZE < 0xFF) &&
+               !(ARP_HASH_SIZE & (ARP_HASH_SIZE - 1)),
+               "ARP_TBL_SIZE must be less than 255, "
+               "ARP_HASH_SIZE must be a power of 2");
+
+#define ARP_NIL 0xFF    // end of hash chain
+
+struct arp_stats_s arp_stats;
+
+static struct arp_tbl_entry_s arp_tbl[ARP_TBL_SIZE];
+static uint8_t arp_hash_tbl[ARP_HASH_SIZE];     // first entry of bucket
+static uint32_t arp_timer_last;     // last run of arp_timer()
+
+/* Token bucket of ARP transmission rate limit */
+static uint8_t arp_rl_tokens;
+static uint32_t arp_rl_last;    // time of last token refill
+
+_Static_assert((ARP_RATE > 0) && (ARP_RATE <= NET_HZ),
+               "ARP_RATE must be in range 1..NET_HZ");
+
+/*!
+ * @brief Take the token of ARP transmission rate limit
+ * @return True if packet may be sent
+ */
+static bool arp_rate_allow(void) {
+    uint32_t now = net_jiffies();
+    uint32_t n = (now - arp_rl_last) / (NET_HZ / ARP_RATE);
+
+    if (n) {
+        arp_rl_last += n * (NET_HZ / ARP_RATE);
+        if (n >= (uint32_t)(ARP_RATE_BURST - arp_rl_tokens))
+            arp_rl_tokens = ARP_RATE_BURST;
+        else
+            arp_rl_tokens += n;
+    }
+
+    if (!arp_rl_tokens)
+        return false;
+    arp_rl_tokens--;
+    return true;
+}
+
+/*!
+ * @brief Transmit ARP packet within the global rate limit
+ * @param net_buff Buffer with ARP packet
+ * @return 0 if success; NET_XMIT_DROP if rate limit is exceeded
+ */
+static int8_t arp_xmit(struct net_buff_s *net_buff) {
+    if (!arp_rate_allow()) {
+        arp_stats.rate_drops++;
+        free_net_buff(net_buff);
+        return NET_XMIT_DROP;
+    }
+    return netdev_list_xmit(net_buff);
+}
+
+/*!
+ * @brief Get hash bucket of IP address
+ */
+static inline uint8_t arp_hash(const uint8_t *ip) {
+    uint8_t h = ip[0] ^ ip[1] ^ ip[2] ^ ip[3];
+
+    return (h ^ (h >> 4)) & (ARP_HASH_SIZE - 1);
+}
+
+/*!
+ * @brief Search the entry for the IP address on the device
+ * @param net_dev Network device
+ * @param ip IP address to search
+ * @return Pointer to entry or NULL if there is no entry
+ */
+static struct arp_tbl_entry_s *arp_tbl_find(struct net_dev_s *net_dev,
+                                            const uint8_t *ip) {
+    uint8_t i = arp_hash_tbl[arp_hash(ip)];
+
+    while (i != ARP_NIL) {
+        if ((arp_tbl[i].net_dev == net_dev) &&
+            !memcmp(&arp_tbl[i].ip, ip, IP4_LEN))
+            return &arp_tbl[i];
+        i = arp_tbl[i].hnext;
+    }
+    return NULL;
+}
+
+/*!
+ * @brief Drop packets waiting for resolution of neighbour
+ * @param ent ARP cache entry
+ */
+static void arp_pending_drop(struct arp_tbl_entry_s *ent) {
+    struct net_buff_s *nb;
+
+    while ((nb = nb_dequeue(&ent->pending))) {
+        free_net_buff(nb);
+        arp_stats.unres_drops++;
+    }
+}
+
+/*!
+ * @brief Build the cached link layer header of resolved neighbour
+ * @param ent ARP cache entry
+ * @return True if cached header is valid
+ */
+static bool arp_hh_update(struct arp_tbl_entry_s *ent) {
+    struct net_dev_s *ndev = ent->net_dev;
+    int8_t (*cache_f)(const struct net_dev_s *, uint16_t,
+                      const void *, uint8_t *);
+
+    if (ent->hh_len)
+        return true;
+
+    if (!ndev->header_ops || (ndev->hard_hdr_len > ARP_HH_LEN) ||
+        !(cache_f = pgm_read_ptr(&ndev->header_ops->cache)))
+        return false;
+
+    if (cache_f(ndev, ETH_P_IP, ent->mac, ent->hh))
+        return false;
+    ent->hh_len = ndev->hard_hdr_len;
+
+    return true;
+}
+
+/*!
+ * @brief Push the link layer header of IP packet to resolved neighbour.
+ * The cached header is copied if device supports it.
+ * @param ent ARP cache entry
+ * @param nb Buffer with IP packet
+ * @return 0 if success
+ */
+static int8_t arp_hh_output(struct arp_tbl_entry_s *ent,
+                            struct net_buff_s *nb) {
+    uint8_t *hdr;
+
+    if (!arp_hh_update(ent))
+        return netdev_hdr_create(nb, ent->net_dev, ETH_P_IP, ent->mac,
+                                 ent->net_dev->dev_addr, nb_len(nb));
+
+    hdr = push_net_buff(nb, ent->hh_len);
+    if (!hdr)
+        return -1;
+    memcpy(hdr, ent->hh, ent->hh_len);
+    nb_reset_mac_hdr(nb);
+
+    return 0;
+}
+
+/*!
+ * @brief Transmit packets waiting for resolution of neighbour
+ * with the resolved destination MAC
+ * @param ent ARP cache entry
+ */
+static void arp_pending_xmit(struct arp_tbl_entry_s *ent) {
+    struct net_buff_s *nb;
+
+    while ((nb = nb_dequeue(&ent->pending))) {
+        if (arp_hh_output(ent, nb)) {
+            free_net_buff(nb);
+            continue;
+        }
+        netdev_list_xmit(nb);
+    }
+}
+
+/*!
+ * @brief Remove entry from the hash bucket and free it.
+ * Packets waiting for resolution are dropped.
+ * @param ent Entry to remove
+ */
+static void arp_tbl_del(struct arp_tbl_entry_s *ent) {
+    uint8_t idx = ent - arp_tbl;
+    uint8_t *pi = &arp_hash_tbl[arp_hash((uint8_t *)&ent->ip)];
+
+    while (*pi != ARP_NIL) {
+        if (*pi == idx) {
+            *pi = ent->hnext;
+            break;
+        }
+        pi = &arp_tbl[*pi].hnext;
+    }
+    arp_pending_drop(ent);
+    ent->state = ARP_NONE;
+    ent->net_dev = NULL;
+}
+
+/*!
+ * @brief Get a new entry for the IP address. If the cache is full,
+ * the least recently used entry is evicted.
+ * @param net_dev Network device
+ * @param ip IP address
+ * @return Pointer to entry (with ARP_NONE state)
+ */
+static struct arp_tbl_entry_s *arp_tbl_alloc(struct net_dev_s *net_dev,
+                                             const uint8_t *ip) {
+    struct arp_tbl_entry_s *ent = NULL;
+    uint8_t h;
+
+    for (uint8_t i = 0; i < ARP_TBL_SIZE; i++) {
+        if (arp_tbl[i].state == ARP_NONE) {
+            ent = &arp_tbl[i];
+            break;
+        }
+        if (!ent || net_time_after(ent->used, arp_tbl[i].used))
+            ent = &arp_tbl[i];
+    }
+    if (ent->state != ARP_NONE)
+        arp_tbl_del(ent);
+
+    ent->net_dev = net_dev;
+    memcpy(&ent->ip, ip, IP4_LEN);
+    ent->used = net_jiffies();
+    ent->hh_len = 0;
+
+    h = arp_hash(ip);
+    ent->hnext = arp_hash_tbl[h];
+    arp_hash_tbl[h] = ent - arp_tbl;
+
+    return ent;
+}
+
+/*!
+ * @brief Note the use of resolved entry for transmit. Stale entry
+ * goes to delay: if neighbour is not confirmed in ARP_DELAY_TIME,
+ * it is probed by unicast requests (see \a arp_timer())
+ * @param ent ARP cache entry
+ */
+static void arp_tbl_use(struct arp_tbl_entry_s *ent) {
+    ent->used = net_jiffies();
+    if (ent->state == ARP_STALE) {
+        ent->state = ARP_DELAY;
+        ent->updated = ent->used;
+    }
+}
 
 /*!
- * @brief Search the IP and MAC address to the ARP table
+ * @brief Set the IP and MAC address to the ARP table
+ * @param net_dev Network device the neighbour is reachable on
  * @param ip IP address to set
  * @param mac MAC address to set
  */
-void arp_tbl_set(uint8_t *restrict ip, uint8_t *restrict mac) {
-    if (memcmp(&arp_tbl.ip, ip, IP4_LEN))
-        memcpy(&arp_tbl.ip, ip, IP4_LEN);
+void arp_tbl_set(struct net_dev_s *net_dev,
+                 uint8_t *restrict ip, uint8_t *restrict mac) {
+    struct arp_tbl_entry_s *ent = arp_tbl_find(net_dev, ip);
+
+    if (!ent)
+        ent = arp_tbl_alloc(net_dev, ip);
 
-    memcpy(arp_tbl.mac, mac, ETH_MAC_LEN);
+    /* neighbour has changed MAC - cached header is not valid */
+    if (memcmp(ent->mac, mac, ETH_MAC_LEN)) {
+        memcpy(ent->mac, mac, ETH_MAC_LEN);
+        ent->hh_len = 0;
+    }
+    ent->state = ARP_REACHABLE;
+    ent->updated = net_jiffies();
+
+    /* neighbour is resolved - release the waiting packets */
+    if (nb_peek(&ent->pending))
+        arp_pending_xmit(ent);
 }
 
 /*!
  * @brief Search the IP address in the ARP table
  *  and return the corresponding MAC address
+ * @param net_dev Network device
  * @param ip IP address to search
  * @return MAC address or NULL if there is no entry
+ *  or address is not resolved yet
  */
-uint8_t *arp_tbl_get(uint8_t *ip) {
-    if (!memcmp(&arp_tbl.ip, ip, IP4_LEN))
-        return arp_tbl.mac;
-    return NULL;
+uint8_t *arp_tbl_get(struct net_dev_s *net_dev, uint8_t *ip) {
+    struct arp_tbl_entry_s *ent = arp_tbl_find(net_dev, ip);
+
+    if (!ent || (ent->state == ARP_INCOMPLETE))
+        return NULL;
+
+    arp_tbl_use(ent);
+    return ent->mac;
+}
+
+/*!
+ * @brief Send the request and schedule the next retransmission:
+ * broadcast to resolve incomplete entry, unicast to the cached
+ * address to verify the probed entry
+ * @param ent ARP cache entry
+ */
+static void arp_solicit(struct arp_tbl_entry_s *ent) {
+    struct net_buff_s *nb;
+    const uint8_t *dest_hw = NULL;
+
+    ent->probes++;
+    ent->updated = net_jiffies();
+    if (ent->state == ARP_PROBE)
+        dest_hw = ent->mac;
+
+    nb = arp_create(ent->net_dev, ARP_OP_REQ, ETH_P_IP, dest_hw,
+                    NULL, NULL, NULL, (const uint8_t *)&ent->ip);
+    if (nb)
+        arp_xmit(nb);
+}
+
+/*!
+ * @brief Transmit the packet to neighbour. If the neighbour is not
+ * resolved, the packet waits in the queue of neighbour entry and
+ * ARP request is sent (then retransmitted by \a arp_timer()). Packets
+ * are transmitted on ARP reply or dropped when the entry is given up.
+ * @param net_dev Network device
+ * @param ip IP address of neighbour
+ * @param nb Buffer with network layer header; link layer header
+ *           is created when the neighbour is resolved
+ * @return NET_XMIT_SUCCESS if packet is queued;
+ *         NET_XMIT_DROP if waiting queue is full or pool is low
+ */
+int8_t arp_queue_xmit(struct net_dev_s *net_dev, const uint8_t *ip,
+                      struct net_buff_s *nb) {
+    struct arp_tbl_entry_s *ent = arp_tbl_find(net_dev, ip);
+    /* last buffers of pool are left for ARP request and reply */
+    bool drop = nb_pool_low();
+
+    if (!ent) {
+        ent = arp_tbl_alloc(net_dev, ip);
+        ent->state = ARP_INCOMPLETE;
+        ent->probes = 0;
+        if (drop) {
+            free_net_buff(nb);
+            arp_stats.unres_drops++;
+        } else {
+            nb_enqueue(nb, &ent->pending);
+        }
+
+        arp_solicit(ent);
+        return drop ? NET_XMIT_DROP : NET_XMIT_SUCCESS;
+    }
+
+    if (drop || (ent->pending.q_len >= ARP_QUEUE_LEN)) {
+        free_net_buff(nb);
+        arp_stats.unres_drops++;
+        return NET_XMIT_DROP;
+    }
+
+    nb_enqueue(nb, &ent->pending);
+
+    /* resolved meanwhile */
+    if (ent->state != ARP_INCOMPLETE) {
+        arp_tbl_use(ent);
+        arp_pending_xmit(ent);
+    }
+
+    return NET_XMIT_SUCCESS;
+}
+
+/*!
+ * @brief Push the link layer header of IP packet to neighbour
+ * from the cached header of ARP entry
+ * @param net_dev Network device
+ * @param ip IP address of neighbour
+ * @param nb Buffer with IP packet
+ * @return 0 if success; 1 if neighbour is not resolved; -1 if error
+ */
+int8_t arp_hh_push(struct net_dev_s *net_dev, const uint8_t *ip,
+                   struct net_buff_s *nb) {
+    struct arp_tbl_entry_s *ent = arp_tbl_find(net_dev, ip);
+
+    if (!ent || (ent->state == ARP_INCOMPLETE))
+        return 1;
+
+    arp_tbl_use(ent);
+    return arp_hh_output(ent, nb);
+}
+
+/*!
+ * @brief Invalidate cached headers of the device entries
+ * (e.g. device MAC is changed)
+ * @param net_dev Network device
+ */
+void arp_hh_flush(struct net_dev_s *net_dev) {
+    for (uint8_t i = 0; i < ARP_TBL_SIZE; i++) {
+        if (arp_tbl[i].net_dev == net_dev)
+            arp_tbl[i].hh_len = 0;
+    }
+}
+
+/*!
+ * @brief Remove all entries of the device
+ * @param net_dev Network device
+ */
+void arp_dev_flush(struct net_dev_s *net_dev) {
+    for (uint8_t i = 0; i < ARP_TBL_SIZE; i++) {
+        if ((arp_tbl[i].state != ARP_NONE) &&
+            (arp_tbl[i].net_dev == net_dev))
+            arp_tbl_del(&arp_tbl[i]);
+    }
+}
+
+/*!
+ * @brief Age the ARP cache entries. Called periodically from the
+ * main loop; runs not more often than once per second.
+ */
+void arp_timer(void) {
+    uint32_t now = net_jiffies();
+
+    if (!net_time_after(now, arp_timer_last + NET_HZ - 1))
+        return;
+    arp_timer_last = now;
+
+    for (uint8_t i = 0; i < ARP_TBL_SIZE; i++) {
+        struct arp_tbl_entry_s *ent = &arp_tbl[i];
+
+        switch (ent->state) {
+            case ARP_INCOMPLETE:
+                /* retransmit with exponential backoff: 1, 2, 4... */
+                if (!net_time_after(now, ent->updated - 1 +
+                                         ((uint32_t)ARP_RETRANS_TIME * NET_HZ
+                                          << (ent->probes - 1))))
+                    break;
+                if (ent->probes >= ARP_MAX_PROBES)
+                    arp_tbl_del(ent);
+                else
+                    arp_solicit(ent);
+                break;
+
+            case ARP_REACHABLE:
+                if (net_time_after(now, ent->updated +
+                                        (uint32_t)ARP_REACHABLE_TIME * NET_HZ))
+                    ent->state = ARP_STALE;
+                break;
+
+            case ARP_STALE:
+                if (net_time_after(now, ent->used +
+                                        (uint32_t)ARP_GC_TIME * NET_HZ))
+                    arp_tbl_del(ent);
+                break;
+
+            case ARP_DELAY:
+                /* not confirmed meanwhile - probe it */
+                if (!net_time_after(now, ent->updated - 1 +
+                                         (uint32_t)ARP_DELAY_TIME * NET_HZ))
+                    break;
+                ent->state = ARP_PROBE;
+                ent->probes = 0;
+                arp_solicit(ent);
+                break;
+
+            case ARP_PROBE:
+                if (!net_time_after(now, ent->updated - 1 +
+                                         (uint32_t)ARP_RETRANS_TIME * NET_HZ))
+                    break;
+                /* neighbour is gone or has changed MAC - resolve anew */
+                if (ent->probes >= ARP_MAX_PROBES)
+                    arp_tbl_del(ent);
+                else
+                    arp_solicit(ent);
+                break;
+
+            default:
+                break;
+        }
+    }
 }
 
 /*!
@@ -42,11 +471,7 @@ uint8_t *arp_tbl_get(uint8_t *ip) {
  * @return Pointer to ARP header
  */
 static struct arp_hdr_s *get_arp_hdr(struct net_buff_s *net_buff) {
-    return (void *)(net_buff->head + net_buff->network_hdr_offset);
-}
-
-static inline int8_t arp_xmit(struct net_buff_s *net_buff) {
-    return netdev_list_xmit(net_buff);
+    return nb_network_hdr(net_buff);
 }
 
 /*!
@@ -57,7 +482,7 @@ static inline int8_t arp_xmit(struct net_buff_s *net_buff) {
 static int8_t arp_proc(struct net_buff_s *net_buff) {
     int8_t ret = NETDEV_RX_DROP;
     struct arp_hdr_s *arph = get_arp_hdr(net_buff);
-    struct net_dev_s *ndev;
+    struct net_dev_s *ndev = net_buff->net_dev;
     struct eth_header_s *eth_hdr;
 
     if ((arph->ptype != htons(ETH_P_IP)) ||
@@ -78,18 +503,24 @@ static int8_t arp_proc(struct net_buff_s *net_buff) {
     if (!memcmp(arph->spa, arph->tpa, IP4_LEN))
         goto free_buf;
 
+    /* RFC 826: refresh the sender if it is already in the cache */
+    if (!ip4_is_zero(arph->spa) && arp_tbl_find(ndev, arph->spa))
+        arp_tbl_set(ndev, arph->spa, arph->sha);
+
     /* check if the packet is for us */
-    if (memcmp(arph->tpa, &my_ip, IP4_LEN))
+    if (memcmp(arph->tpa, &ndev->ip_addr, IP4_LEN))
         goto free_buf;
 
+    /* the sender is going to talk to us - remember it */
+    if (!ip4_is_zero(arph->spa))
+        arp_tbl_set(ndev, arph->spa, arph->sha);
+
     /* Send reply if it is a REQUEST for us */
     if (arph->oper == htons(ARP_OP_REQ)) {
         /** TODO: so far, the same net buffer is used that
          * we received, just overwrite the required fields.
          */
-        net_buff->pkt_len -= 4;
-        ndev = net_buff->net_dev;
-        eth_hdr = (void *)(net_buff->head + net_buff->mac_hdr_offset);
+        eth_hdr = push_net_buff(net_buff, ETH_HDR_LEN);
 
         /* transmit the reply */
         /* set fields */
@@ -99,20 +530,19 @@ static int8_t arp_proc(struct net_buff_s *net_buff) {
         memcpy(arph->tpa, arph->spa, IP4_LEN);
 
         memcpy(arph->sha, ndev->dev_addr, ETH_MAC_LEN);
-        memcpy(arph->spa, &my_ip, IP4_LEN);
+        memcpy(arph->spa, &ndev->ip_addr, IP4_LEN);
 
         memcpy(eth_hdr->mac_dest, eth_hdr->mac_src, ETH_MAC_LEN);
         memcpy(eth_hdr->mac_src, ndev->dev_addr, ETH_MAC_LEN);
 
         /* and finally, begin transmission... */
+        net_buff->flags.priority = NB_PRIO_CTRL;
         arp_xmit(net_buff);
 
         ret = NETDEV_RX_SUCCESS;
         goto out;
     }
 
-    /* If it is a REPLY, update ARP table */
-    arp_tbl_set(arph->spa, arph->sha);
     ret = NETDEV_RX_SUCCESS;
 
 free_buf:
@@ -136,6 +566,12 @@ static int8_t arp_recv(struct net_buff_s *net_buff) {
         goto out;
     }
 
+    if (nb_len(net_buff) < sizeof(struct arp_hdr_s))
+        goto out;
+
+    /* remove link layer padding and CRC */
+    trim_net_buff(net_buff, sizeof(struct arp_hdr_s));
+
     arph = get_arp_hdr(net_buff);
 
     if ((arph->hlen == ETH_MAC_LEN) || (arph->plen == IP4_LEN))
@@ -151,7 +587,14 @@ out:
  * @brief Initial the ARP protocol and set the handler for him
  */
 void arp_init(void) {
-    memset(&arp_tbl, 0, sizeof(arp_tbl));
+    memset(arp_tbl, 0, sizeof(arp_tbl));
+    memset(&arp_stats, 0, sizeof(arp_stats));
+    for (uint8_t i = 0; i < ARP_TBL_SIZE; i++)
+        nb_queue_init(&arp_tbl[i].pending);
+    memset(arp_hash_tbl, ARP_NIL, sizeof(arp_hash_tbl));
+    arp_timer_last = net_jiffies();
+    arp_rl_last = arp_timer_last;
+    arp_rl_tokens = ARP_RATE_BURST;
     pkt_hdlr_add(ETH_P_ARP, arp_recv);
 }
 
@@ -177,25 +620,25 @@ struct net_buff_s *arp_create(struct net_dev_s *net_dev,
     struct arp_hdr_s *arph;
 
     net_buff = ndev_alloc_net_buff(net_dev,
-                                   (sizeof(struct eth_header_s) +
+                                   (net_dev->hard_hdr_len +
                                     sizeof(struct arp_hdr_s)));
     if (!net_buff)
         return NULL;
 
+    reserve_net_buff(net_buff, net_dev->hard_hdr_len);
+
     if (!dest_hw)
         dest_hw = net_dev->broadcast;
     if (!sha)
         sha = net_dev->dev_addr;
     if (!spa)
-        spa = (void *)&my_ip;
+        spa = (void *)&net_dev->ip_addr;
 
     net_buff->protocol = htons(ETH_P_ARP);
-    net_buff->tail += ETH_HDR_LEN;
-    if (netdev_hdr_create(net_buff, net_dev, ETH_P_ARP,
-                          dest_hw, sha, net_buff->pkt_len))
-        goto out;
+    net_buff->flags.priority = NB_PRIO_CTRL;
 
     arph = put_net_buff(net_buff, sizeof(struct arp_hdr_s));
+    nb_reset_network_hdr(net_buff);
     arph->htype = htons(1); // Hardware type is Ethernet
     arph->ptype = htons(ptype);
     arph->hlen = ETH_MAC_LEN;
@@ -209,6 +652,10 @@ struct net_buff_s *arp_create(struct net_dev_s *net_dev,
         memset(arph->tha, 0, ETH_MAC_LEN);
     memcpy(arph->tpa, tpa, IP4_LEN);
 
+    if (netdev_hdr_create(net_buff, net_dev, ETH_P_ARP,
+                          dest_hw, sha, nb_len(net_buff)))
+        goto out;
+
     return net_buff;
 
 out:
@@ -227,14 +674,25 @@ out:
  * @param spa Source IP
  * @param tha Target MAC (migth be \a NULL)
  * @param tpa Target IP
+ * @return 0 if success
  */
 int8_t arp_send(struct net_dev_s *net_dev,
                  uint16_t oper, uint16_t ptype,
                  const uint8_t *dest_hw,
                  const uint8_t *sha, const uint8_t *spa,
                  const uint8_t *tha, const uint8_t *tpa) {
+    struct arp_tbl_entry_s *ent;
     struct net_buff_s *nb;
 
+    /* request for the target is already outstanding */
+    if ((oper == ARP_OP_REQ) && (ptype == ETH_P_IP)) {
+        ent = arp_tbl_find(net_dev, tpa);
+        if (ent && (ent->state == ARP_INCOMPLETE)) {
+            arp_stats.req_coalesced++;
+            return 0;
+        }
+    }
+
     nb = arp_create(net_dev, oper, ptype, dest_hw, sha, spa, tha, tpa);
     if (!nb) {
         printf_P(PSTR("arp_send(): failed to creating buffer\n"));
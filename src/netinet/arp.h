@@ -5,14 +5,106 @@
 
 #include "net/net.h"
 #include "net/ether.h"
+#include "net/nb_queue.h"
 #include "netinet/ip.h"
 
-struct __attribute__((packed)) arp_tbl_entry_s {
+/* Number of ARP cache entries (less than 255)
+ * and number of hash buckets (power of 2).
+ * Defaults are sized by SRAM of the part (see NET_STATIC_RAM_MAX).
+ * May be overridden at compile time */
+#ifndef ARP_TBL_SIZE
+#if defined(RAMEND) && (RAMEND < 0x1000)    // 2 KB of SRAM
+#define ARP_TBL_SIZE 4
+#elif defined(RAMEND) && (RAMEND < 0x2000)  // up to 4 KB of SRAM
+#define ARP_TBL_SIZE 8
+#else
+#define ARP_TBL_SIZE 16
+#endif
+#endif
+#ifndef ARP_HASH_SIZE
+#if defined(RAMEND) && (RAMEND < 0x1000)
+#define ARP_HASH_SIZE 4
+#else
+#define ARP_HASH_SIZE 8
+#endif
+#endif
+
+/* ARP cache timeouts, seconds. May be overridden at compile time */
+#ifndef ARP_REACHABLE_TIME
+#define ARP_REACHABLE_TIME 60   // confirmed entry becomes stale
+#endif
+#ifndef ARP_GC_TIME
+#define ARP_GC_TIME 300         // unused stale entry is removed
+#endif
+#ifndef ARP_DELAY_TIME
+#define ARP_DELAY_TIME 5        // used stale entry is probed
+#endif
+
+/* Resolution retries: request is retransmitted with interval doubled
+ * each time (seconds), entry is given up after ARP_MAX_PROBES requests.
+ * Stale entry in use is verified by ARP_MAX_PROBES unicast requests
+ * sent each ARP_RETRANS_TIME. May be overridden at compile time */
+#ifndef ARP_RETRANS_TIME
+#define ARP_RETRANS_TIME 1
+#endif
+#ifndef ARP_MAX_PROBES
+#define ARP_MAX_PROBES 3
+#endif
+
+/* Global limit of ARP transmission: ARP_RATE packets per second
+ * with bursts up to ARP_RATE_BURST packets. May be overridden
+ * at compile time */
+#ifndef ARP_RATE
+#define ARP_RATE 10
+#endif
+#ifndef ARP_RATE_BURST
+#define ARP_RATE_BURST 5
+#endif
+
+/* Max. number of packets waiting for resolution of one neighbour.
+ * May be overridden at compile time */
+#ifndef ARP_QUEUE_LEN
+#define ARP_QUEUE_LEN 2
+#endif
+
+/* Max. length of cached link layer header */
+#define ARP_HH_LEN ETH_HDR_LEN
+
+/* ARP cache entry states */
+#define ARP_NONE 0          // free entry
+#define ARP_INCOMPLETE 1    // request is sent, waiting for reply
+#define ARP_REACHABLE 2     // address is recently confirmed
+#define ARP_STALE 3         // address is not confirmed for long, but usable
+#define ARP_DELAY 4         // stale address is used, waiting for confirmation
+#define ARP_PROBE 5         // address is verified by unicast requests
+
+struct arp_tbl_entry_s {
+    struct net_dev_s *net_dev;  // interface the neighbour is reachable on
     in_addr_t ip;
     uint8_t mac[ETH_MAC_LEN];
+    uint8_t state;      // e.g. ARP_REACHABLE
+    uint8_t hnext;      // index of next entry in hash bucket
+    uint8_t probes;     // requests sent for incomplete entry
+    uint32_t updated;   // time of last confirmation or request (jiffies)
+    uint32_t used;      // time of last use (jiffies)
+    struct nb_queue_s pending;  // packets waiting for resolution
+    uint8_t hh_len;             // length of cached header; 0 - not valid
+    uint8_t hh[ARP_HH_LEN];     // cached link layer header to neighbour
+};
+
+/*!
+ * @brief ARP statistics
+ * @param unres_drops Packets dropped while waiting for resolution
+ * @param req_coalesced Requests suppressed as one is already outstanding
+ * @param rate_drops ARP packets not sent due to rate limit
+ */
+struct arp_stats_s {
+    uint16_t unres_drops;
+    uint16_t req_coalesced;
+    uint16_t rate_drops;
 };
 
-extern struct arp_tbl_entry_s arp_tbl;
+extern struct arp_stats_s arp_stats;
 
 struct arp_hdr_s {
     uint16_t htype; // Hardware Type
@@ -32,8 +124,16 @@ struct arp_hdr_s {
 #define ARP_OP_REQ 1    // ARP Request
 #define ARP_OP_REPLY 2  // ARP Reply
 
-void arp_tbl_set(uint8_t *restrict ip, uint8_t *restrict mac);
-uint8_t *arp_tbl_get(uint8_t *ip);
+void arp_tbl_set(struct net_dev_s *net_dev,
+                 uint8_t *restrict ip, uint8_t *restrict mac);
+uint8_t *arp_tbl_get(struct net_dev_s *net_dev, uint8_t *ip);
+int8_t arp_queue_xmit(struct net_dev_s *net_dev, const uint8_t *ip,
+                      struct net_buff_s *nb);
+int8_t arp_hh_push(struct net_dev_s *net_dev, const uint8_t *ip,
+                   struct net_buff_s *nb);
+void arp_hh_flush(struct net_dev_s *net_dev);
+void arp_dev_flush(struct net_dev_s *net_dev);
+void arp_timer(void);
 
 void arp_init(void);
 struct net_buff_s *arp_create(struct net_dev_s *net_dev,
@@ -5,7 +5,6 @@
 #include "net/net.h"
 #include "net/net_dev.h"
 #include "net/checksum.h"
-#include "net/ipconfig.h"
 #include "net/ether.h"
 #include "netinet/ip.h"
 #include "netinet/icmp.h"
@@ -16,7 +15,7 @@
  * @return Pointer to ICMP header
  */
 static struct icmp_hdr_s *get_icmp_hdr(struct net_buff_s *net_buff) {
-    return (void *)(net_buff->head + net_buff->transport_hdr_offset);
+    return nb_transport_hdr(net_buff);
 }
 
 /*!
@@ -45,29 +44,41 @@ static inline bool icmp_is_query(uint8_t type) {
  */
 static bool icmp_echo(struct net_buff_s *nb) {
     struct net_dev_s *ndev = nb->net_dev;
-    struct eth_header_s *eth_hdr = (void *)(nb->head + nb->mac_hdr_offset);
+    struct eth_header_s *eth_hdr = nb_mac_hdr(nb);
     struct ip_hdr_s *iph = get_ip_hdr(nb);
     struct icmp_hdr_s *icmp_h = get_icmp_hdr(nb);
 
     /* drop if IP not ours */
-    if (iph->ip_dst != my_ip)
+    if (iph->ip_dst != ndev->ip_addr)
         return NETDEV_RX_DROP;
 
     /** FIXME: used old net buffer to reply */
-    nb->pkt_len -= 4;
+    push_net_buff(nb, nb->transport_hdr_offset - nb->mac_hdr_offset);
 
     memcpy(eth_hdr->mac_dest, eth_hdr->mac_src, ETH_MAC_LEN);
     memcpy(eth_hdr->mac_src, ndev->dev_addr, ETH_MAC_LEN);
 
+    /* addresses are swapped, so the sum of header is not changed
+     * by them; only TTL is updated incrementally (RFC 1624) */
     memcpy(&iph->ip_dst, &iph->ip_src, IP4_LEN);
-    memcpy(&iph->ip_src, &my_ip, IP4_LEN);
+    memcpy(&iph->ip_src, &ndev->ip_addr, IP4_LEN);
+    if (ndev->features & NETDEV_F_TXCSUM)
+        iph->hdr_chks = 0;
+    else
+        csum_replace2(&iph->hdr_chks, htons(iph->ttl << 8),
+                      htons((uint8_t)(iph->ttl - 1) << 8));
     iph->ttl--;
-    iph->hdr_chks = 0;
-    iph->hdr_chks = in_checksum(iph, iph->ihl * 4);
 
+    /* reply with the same type of service as request */
+    nb->flags.priority = ip_tos2prio(iph->tos);
+
+    /* only the type is changed, the data is not summed again */
+    csum_replace2(&icmp_h->chks, htons(icmp_h->type << 8),
+                  htons(ICMP_ECHO_REPLY << 8));
     icmp_h->type = ICMP_ECHO_REPLY;
-    icmp_h->chks = 0;
-    icmp_h->chks = in_checksum(icmp_h, (ntohs(iph->tot_len) - iph->ihl * 4));
+
+    /* checksums are complete, the flag of received buffer is not valid */
+    nb->flags.ip_summed = CHECKSUM_NONE;
 
     netdev_list_xmit(nb);
 
@@ -91,7 +102,7 @@ int8_t icmp_recv(struct net_buff_s *nb) {
         goto drop;
 
     /* drop if invalid checksum */
-    if (in_checksum(icmp_h, (ntohs(iph->tot_len) - iph->ihl * 4)))
+    if (!nb_csum_unnecessary(nb) && nb_checksum(nb, 0, nb_len(nb)))
         goto drop;
 
     /* handlers of the specified ICMP types */
@@ -27,6 +27,9 @@ struct sockaddr_in {
 #define IPPROTO_IPV6    41  // IPv6-in-IPv4 tunnelling
 #define IPPROTO_RAW     255 // Raw IP packet
 
+/* Options for level IPPROTO_IP */
+#define IP_TOS          1   // Type of service for outgoing packets (int)
+
 #define INADDR_ANY ((in_addr_t)0x00000000)           // 0.0.0.0
 #define INADDR_BROADCAST ((in_addr_t)0xFFFFFFFF)     // 255.255.255.255
 #define INADDR_NONE ((in_addr_t)0xFFFFFFFF)          // 255.255.255.255
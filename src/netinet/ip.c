@@ -4,8 +4,11 @@
 #include "net/net.h"
 #include "net/pkt_handler.h"
 #include "net/checksum.h"
+#include "net/net_dev.h"
 #include "net/ipconfig.h"
 #include "netinet/ip.h"
+#include "netinet/arp.h"
+#include "netinet/route.h"
 #include "netinet/icmp.h"
 #include "netinet/tcp.h"
 #include "netinet/udp.h"
@@ -16,7 +19,110 @@
  * @return Pointer to IP header
  */
 struct ip_hdr_s *get_ip_hdr(struct net_buff_s *net_buff) {
-    return (void *)(net_buff->head + net_buff->network_hdr_offset);
+    return nb_network_hdr(net_buff);
+}
+
+/*!
+ * @brief Check that the address is limited or subnet broadcast
+ * of the interface
+ * @param ndev Network device
+ * @param addr IP address
+ * @return True if \p addr is broadcast
+ */
+static bool ip_is_dev_broadcast(const struct net_dev_s *ndev, in_addr_t addr) {
+    if (ip4_is_broadcast(&addr))
+        return true;
+
+    /* subnet directed broadcast */
+    return ((ndev->ip_mask != htonl(INADDR_NONE)) &&
+            (addr == (ndev->ip_addr | ~ndev->ip_mask)));
+}
+
+/*!
+ * @brief Check that the destination address belongs to the interface:
+ * own address, limited or subnet broadcast, or multicast
+ * @param ndev Receiving network device
+ * @param dst Destination IP address
+ * @return True if packet is for this interface
+ */
+static bool ip_dst_is_local(const struct net_dev_s *ndev, in_addr_t dst) {
+    return ((dst == ndev->ip_addr) || ip4_is_multicast(&dst) ||
+            ip_is_dev_broadcast(ndev, dst));
+}
+
+/*!
+ * @brief Select the output device and the next hop for the socket
+ * destination. Broadcast and multicast are sent through the device
+ * of the source address (or default device), others are routed.
+ * @param sk Socket
+ * @param nh Pointer to store the next hop IP address
+ * @return Output device or \a NULL if destination is unreachable
+ */
+static struct net_dev_s *ip_output_dev(const struct socket *sk,
+                                       in_addr_t *nh) {
+    struct rtable_s *rt;
+
+    *nh = sk->dst_addr;
+
+    if (ip4_is_broadcast(&sk->dst_addr) || ip4_is_multicast(&sk->dst_addr)) {
+        if (sk->src_addr)
+            return netdev_get_by_inaddr(sk->src_addr);
+        return netdev_get_default();
+    }
+
+    rt = ip_route_output(sk->dst_addr);
+    if (!rt)
+        return NULL;
+
+    *nh = rt_nexthop(rt, sk->dst_addr);
+
+    return rt->net_dev;
+}
+
+/*!
+ * @brief Select the source address for the socket destination:
+ * the address of output device
+ * @param sk Socket with destination address
+ * @return Source IP address or \a INADDR_ANY if destination is unreachable
+ */
+in_addr_t ip_select_saddr(const struct socket *sk) {
+    struct net_dev_s *ndev;
+    in_addr_t nh;
+
+    ndev = ip_output_dev(sk, &nh);
+    if (!ndev)
+        return INADDR_ANY;
+
+    return ndev->ip_addr;
+}
+
+/*!
+ * @brief Get the hardware address of the broadcast or multicast next hop.
+ * Unicast next hop is resolved by ARP.
+ * @param ndev Output device
+ * @param nh Next hop IP address
+ * @param mc_hw Buffer for multicast hardware address
+ * @return Hardware address or \a NULL if next hop is unicast
+ */
+static const uint8_t *ip_nexthop_hw(struct net_dev_s *ndev, in_addr_t nh,
+                                    uint8_t *mc_hw) {
+    if (ip_is_dev_broadcast(ndev, nh))
+        return ndev->broadcast;
+
+    if (ip4_is_multicast(&nh)) {
+        /* RFC 1112: 01:00:5E + low-order 23 bits of group address */
+        const uint8_t *ip = (const uint8_t *)&nh;
+
+        mc_hw[0] = 0x01;
+        mc_hw[1] = 0x00;
+        mc_hw[2] = 0x5E;
+        mc_hw[3] = ip[1] & 0x7F;
+        mc_hw[4] = ip[2];
+        mc_hw[5] = ip[3];
+        return mc_hw;
+    }
+
+    return NULL;
 }
 
 /*!
@@ -27,6 +133,10 @@ struct ip_hdr_s *get_ip_hdr(struct net_buff_s *net_buff) {
 static int8_t ip_recv(struct net_buff_s *nb) {
     struct ip_hdr_s *iph;
 
+    /* device is being configured: its packets are for DHCP client */
+    if (nb->net_dev == dhcp_dev)
+        return dhcp_recv(nb);
+
     if (nb->flags.pkt_type == PKT_OTHERHOST)
         goto out;
 
@@ -39,16 +149,24 @@ static int8_t ip_recv(struct net_buff_s *nb) {
         goto out;
     
     /* checksum is correct? */
-    if (in_checksum(iph, iph->ihl * 4))
+    if (!nb_csum_unnecessary(nb) && in_checksum(iph, iph->ihl * 4))
         goto out;
 
     /* check the length of packet */
-    if ((nb->pkt_len < ntohs(iph->tot_len)) ||
-        (ntohs(iph->tot_len < (iph->ihl * 4))))
+    if ((nb_len(nb) < ntohs(iph->tot_len)) ||
+        (ntohs(iph->tot_len) < (iph->ihl * 4)))
         goto out;
 
+    /* packet is not addressed to the receiving interface */
+    if (!ip_dst_is_local(nb->net_dev, iph->ip_dst))
+        goto out;
+
+    /* remove link layer padding and CRC */
+    trim_net_buff(nb, ntohs(iph->tot_len));
+
     /* set transport header offset */
-    nb->transport_hdr_offset = nb->network_hdr_offset + iph->ihl * 4;
+    pull_net_buff(nb, iph->ihl * 4);
+    nb_reset_transport_hdr(nb);
 
     /** and process...
      *  FIXME: at this time IP options is not support
@@ -76,81 +194,192 @@ void ip_init(void) {
 }
 
 /*!
- * @brief
+ * @brief Allocate the linear buffer for \p len bytes of data, to be
+ * filled in place. The headroom for the transport, IP and link layer
+ * headers is reserved and the data is put (not initialized)
+ * @param sk Socket with destination
+ * @param t_hdr_len Length of the transport layer header (TCP or UDP)
+ * @param len Length of data, not more than the device MTU
+ * without IP and transport headers
+ * @return Buffer or \a NULL if error
+ */
+struct net_buff_s *ip_alloc_nb(struct socket *sk, uint8_t t_hdr_len,
+                               uint16_t len) {
+    struct net_buff_s *nb;
+    struct net_dev_s *ndev;
+    uint8_t hdr_len;
+    in_addr_t nh;
+
+    ndev = ip_output_dev(sk, &nh);
+    if (!ndev)
+        // ENETUNREACH
+        return NULL;
+
+    if (len > ndev->mtu - sizeof(struct ip_hdr_s) - t_hdr_len)
+        // EMSGSIZE
+        return NULL;
+
+    hdr_len = ndev->hard_hdr_len + sizeof(struct ip_hdr_s) + t_hdr_len;
+
+    nb = net_buff_alloc(hdr_len + len);
+    if (!nb)
+        // ENOBUFS
+        return NULL;
+
+    if (!reserve_net_buff(nb, hdr_len)) {
+        free_net_buff(nb);
+        return NULL;
+    }
+    put_net_buff(nb, len);
+    nb->net_dev = ndev;
+    nb->sock = sk;
+
+    return nb;
+}
+
+/*!
+ * @brief Create the buffer with message. The headroom for the transport,
+ * IP and link layer headers is reserved, so the layers push their
+ * headers in place without copying the data. Data of all the I/O vectors
+ * of message is gathered. IP fragmentation is not supported (packets
+ * are sent with DF), so message must fit the MTU of output device.
+ * Message that does not fit into one slab is stored in the chain of
+ * fragments of full and small slabs: on 2 KB parts, where the full slab
+ * is cut below the frame size (see \a NB_SLAB_SIZE), or when the full
+ * slabs are busy.
  * @param sk Socket
  * @param msg Message
  * @param t_hdr_len Length of the transport layer header (TCP or UDP)
  * @param len Length of data + transport header
+ * @param csum Pointer to store the partial checksum of data, computed
+ *             while copying, or \a NULL if it is not needed. If the
+ *             device computes it, the buffer is marked \a CHECKSUM_HW
+ *             and zero is stored
+ * @return Buffer with data or \a NULL if error
  */
 struct net_buff_s *ip_create_nb(struct socket *sk,
                                 struct msghdr *msg,
                                 uint8_t t_hdr_len,
-                                ssize_t len) {
+                                ssize_t len,
+                                uint32_t *csum) {
     struct net_buff_s *nb;
     struct net_dev_s *ndev;
-    struct ip_hdr_s *iph;
-    uint8_t *data;
-    uint16_t pkt_len;
+    uint8_t hdr_len;
+    in_addr_t nh;
 
-    pkt_len = len + sizeof(*iph) + sizeof(struct eth_header_s);
+    ndev = ip_output_dev(sk, &nh);
+    if (!ndev)
+        // ENETUNREACH
+        return NULL;
 
-    /**
-     * TODO: when there are several devices (including virtual ones),
-     * search for the device and its IP by the destination address.
-     * Also need to get the destination MAC (routing).
-     */
-    ndev = curr_net_dev;
-    sk->src_addr = my_ip;
+    if (len < t_hdr_len)
+        // EINVAL
+        return NULL;
+
+    if ((size_t)len > ndev->mtu - sizeof(struct ip_hdr_s))
+        // EMSGSIZE
+        return NULL;
 
-    /** TODO: calculate addr-port hash in socket */
+    hdr_len = ndev->hard_hdr_len + sizeof(struct ip_hdr_s) + t_hdr_len;
 
-    nb = ndev_alloc_net_buff(ndev, pkt_len);
+    /* message larger than slab is splitted to the fragments */
+    nb = ndev_alloc_net_buff_chain(ndev, hdr_len, len - t_hdr_len);
     if (!nb)
         // ENOBUFS
         return nb;
 
-    nb->protocol = ETH_P_IP;
-    nb->tail += ETH_HDR_LEN;
-    nb->transport_hdr_offset = nb->network_hdr_offset + sizeof(*iph);
+    /* copy message to buffer */
+    if (csum && (ndev->features & NETDEV_F_TXCSUM)) {
+        nb->flags.ip_summed = CHECKSUM_HW;
+        *csum = 0;
+        csum = NULL;
+    }
+    if (csum) {
+        *csum = csum_and_copy_from_iov(nb, 0, msg->msg_iov,
+                                       msg->msg_iovlen, 0);
+    } else {
+        const struct iovec *iov = msg->msg_iov;
+        uint16_t off = 0;
 
-    if (netdev_hdr_create(nb, ndev, ETH_P_IP, ndev->broadcast,
-                          ndev->dev_addr, pkt_len))
-        goto error;
+        for (uint8_t i = 0; i < msg->msg_iovlen; i++, iov++) {
+            store_net_buff(nb, off, iov->iov_base, iov->iov_len);
+            off += iov->iov_len;
+        }
+    }
+
+    nb->sock = sk;
+
+    return nb;
+}
+
+/*!
+ * @brief Build IP and link layer headers and queue the buffer to the socket.
+ * Buffer data must point to the transport layer header.
+ * @param sk Socket
+ * @param nb Network buffer
+ * @return 0 if success
+ */
+int8_t ip_queue_xmit(struct socket *sk, struct net_buff_s *nb) {
+    struct net_dev_s *ndev = nb->net_dev;
+    struct ip_hdr_s *iph;
+    uint8_t mc_hw[ETH_MAC_LEN];
+    const uint8_t *hw;
+    in_addr_t nh;
+    int8_t err;
+
+    nb_reset_transport_hdr(nb);
 
     /* build IP header */
-    iph = put_net_buff(nb, sizeof(*iph));
+    iph = push_net_buff(nb, sizeof(*iph));
+    if (!iph)
+        goto error;
+    nb_reset_network_hdr(nb);
 
     iph->version = 4;
     iph->ihl = 5;
-    iph->tos = 0;
-    iph->tot_len = htons(len + sizeof(*iph));
+    iph->tos = sk->tos;
+    iph->tot_len = htons(nb_len(nb));
     iph->id = 0;
     iph->frag_off = htons(IP_DF);
     iph->ttl = 64;
     iph->protocol = sk->protocol;
-    iph->ip_src = sk->src_addr;
+    iph->ip_src = sk->src_addr ? sk->src_addr : ndev->ip_addr;
     iph->ip_dst = sk->dst_addr;
     iph->hdr_chks = 0;
-    iph->hdr_chks = in_checksum(iph, iph->ihl * 4);
+    if (!(ndev->features & NETDEV_F_TXCSUM))
+        iph->hdr_chks = in_checksum(iph, iph->ihl * 4);
 
-    data = put_net_buff(nb, len);   // data is transport_header_offset
+    nb->protocol = htons(ETH_P_IP);
+    nb->flags.priority = ip_tos2prio(sk->tos);
 
-    data += t_hdr_len;  // now data is the pointer to store message
+    /* route is taken from last destination cache */
+    if (ip_output_dev(sk, &nh) != ndev)
+        // ENETUNREACH
+        goto error;
 
-    /* copy message to buffer */
-    memcpy(data, msg->msg_iov->iov_base, msg->msg_iov->iov_len);
+    hw = ip_nexthop_hw(ndev, nh, mc_hw);
+    if (hw) {
+        if (netdev_hdr_create(nb, ndev, ETH_P_IP, hw,
+                              ndev->dev_addr, nb_len(nb)))
+            goto error;
+    } else {
+        /* unicast: copy the cached header of neighbour */
+        err = arp_hh_push(ndev, (const uint8_t *)&nh, nb);
+        if (err > 0)
+            /* next hop is not resolved: packet waits for ARP reply */
+            return arp_queue_xmit(ndev, (const uint8_t *)&nh, nb);
+        if (err)
+            goto error;
+    }
 
     /* add buffer to socket queue */
     nb_enqueue(nb, &sk->nb_tx_q);
 
-    nb->sock = sk;
+    return ip_send_sock(sk);
 
-out:
-    return nb;
 error:
     free_net_buff(nb);
-    nb = NULL;
-    goto out;
+    return -1;
 }
 
 /*!
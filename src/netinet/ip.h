@@ -69,6 +69,19 @@ struct ip_hdr_s {
      * size: 0-10 * 32bits */
 };
 
+/*!
+ * @brief Map IP type of service to transmit priority
+ * @param tos Type of service field
+ * @return Priority (e.g. NB_PRIO_CTRL)
+ */
+static inline uint8_t ip_tos2prio(uint8_t tos) {
+    if ((tos & IP_TOS_LOW_DELAY) || (tos >= IP_TOS_PREC_INET_CTRL))
+        return NB_PRIO_CTRL;
+    if (tos & (IP_TOS_HIGH_THRPUT | IP_TOS_LOWCOST))
+        return NB_PRIO_BULK;
+    return NB_PRIO_NORMAL;
+}
+
 inline bool ip4_is_broadcast(const void *ip) {
     return (*(in_addr_t *)ip == htonl(INADDR_BROADCAST));
 }
@@ -87,10 +100,15 @@ inline bool ip4_is_zero(const void *ip) {
 
 struct ip_hdr_s *get_ip_hdr(struct net_buff_s *net_buff);
 void ip_init(void);
+struct net_buff_s *ip_alloc_nb(struct socket *sk, uint8_t t_hdr_len,
+                               uint16_t len);
 struct net_buff_s *ip_create_nb(struct socket *sk,
                                 struct msghdr *msg,
                                 uint8_t t_hdr_len,
-                                ssize_t len);
+                                ssize_t len,
+                                uint32_t *csum);
+int8_t ip_queue_xmit(struct socket *sk, struct net_buff_s *nb);
+in_addr_t ip_select_saddr(const struct socket *sk);
 int8_t ip_send_sock(struct socket *sk);
 
 int8_t ip_proto_handler(uint8_t proto, struct net_buff_s *net_buff);
@@ -0,0 +1,207 @@
+#include <stdint.h>
+
+#include "net/net_dev.h"
+#include "arpa/inet.h"
+#include "netinet/in.h"
+#include "netinet/route.h"
+
+/*!
+ * @brief Routing table. Starts empty (zeroed BSS) and is never
+ * re-initialized, since routes may be added by ip_auto_config()
+ * before network_init().
+ */
+static struct rtable_s rt_tbl[RT_TBL_SIZE];
+
+/*!
+ * @brief Last destination cache. Consecutive packets usually go
+ * to the same destination, so the table is not scanned for them.
+ */
+static struct {
+    in_addr_t dst;
+    struct rtable_s *rt;
+} rt_cache;
+
+/*!
+ * @brief Drop the last destination cache. Must be called
+ * on any change of routing table.
+ */
+static inline void rt_cache_flush(void) {
+    rt_cache.rt = NULL;
+}
+
+/*!
+ * @brief Check that the route is usable
+ */
+static inline bool rt_is_up(const struct rtable_s *rt) {
+    return ((rt->flags & RTF_UP) && net_dev_upstate_is_run(rt->net_dev));
+}
+
+/*!
+ * @brief Add entry to routing table
+ * @param dst Destination network
+ * @param mask Netmask
+ * @param gw Gateway
+ * @param net_dev Output device
+ * @param flags Route flags
+ * @return 0 if success
+ */
+static int8_t rt_insert(in_addr_t dst, in_addr_t mask, in_addr_t gw,
+                        struct net_dev_s *net_dev, uint8_t flags) {
+    struct rtable_s *rt = NULL;
+
+    for (uint8_t i = 0; i < RT_TBL_SIZE; i++) {
+        if (!(rt_tbl[i].flags & RTF_UP)) {
+            if (!rt)
+                rt = &rt_tbl[i];
+        } else if ((rt_tbl[i].dst == (dst & mask)) &&
+                   (rt_tbl[i].mask == mask) &&
+                   (rt_tbl[i].net_dev == net_dev)) {
+            // EEXIST
+            return -1;
+        }
+    }
+    if (!rt)
+        // ENOBUFS
+        return -1;
+
+    rt->dst = dst & mask;
+    rt->mask = mask;
+    rt->gw = gw;
+    rt->net_dev = net_dev;
+    rt->flags = flags | RTF_UP;
+    rt_cache_flush();
+
+    return 0;
+}
+
+/*!
+ * @brief Add static route
+ * @param dst Destination network
+ * @param mask Netmask of destination network
+ * @param gw Gateway or \a INADDR_ANY for directly connected network
+ * @param net_dev Output device. If \a NULL, the device of
+ *                connected network with \p gw is used
+ * @return 0 if success
+ */
+int8_t route_add(in_addr_t dst, in_addr_t mask, in_addr_t gw,
+                 struct net_dev_s *net_dev) {
+    struct rtable_s *rt;
+    uint8_t flags = RTF_STATIC;
+
+    if (gw) {
+        flags |= RTF_GATEWAY;
+        if (!net_dev) {
+            /* gateway must be directly reachable */
+            rt = ip_route_output(gw);
+            if (!rt || (rt->flags & RTF_GATEWAY))
+                // ENETUNREACH
+                return -1;
+            net_dev = rt->net_dev;
+        }
+    }
+    if (!net_dev)
+        // EINVAL
+        return -1;
+
+    return rt_insert(dst, mask, gw, net_dev, flags);
+}
+
+/*!
+ * @brief Delete route
+ * @param dst Destination network
+ * @param mask Netmask of destination network
+ * @return 0 if success
+ */
+int8_t route_del(in_addr_t dst, in_addr_t mask) {
+    int8_t err = -1;    // ESRCH
+
+    for (uint8_t i = 0; i < RT_TBL_SIZE; i++) {
+        if ((rt_tbl[i].flags & RTF_UP) &&
+            (rt_tbl[i].dst == (dst & mask)) &&
+            (rt_tbl[i].mask == mask)) {
+            rt_tbl[i].flags = 0;
+            err = 0;
+        }
+    }
+    rt_cache_flush();
+
+    return err;
+}
+
+/*!
+ * @brief Add routes of configured interface: connected network
+ * derived from its netmask and default route via its gateway.
+ * Previous routes of interface, except static ones, are replaced.
+ * @param net_dev Network device
+ * @return 0 if success
+ */
+int8_t route_dev_up(struct net_dev_s *net_dev) {
+    int8_t err;
+
+    for (uint8_t i = 0; i < RT_TBL_SIZE; i++) {
+        if ((rt_tbl[i].net_dev == net_dev) &&
+            !(rt_tbl[i].flags & RTF_STATIC))
+            rt_tbl[i].flags = 0;
+    }
+    rt_cache_flush();
+
+    if ((net_dev->ip_addr == htonl(INADDR_NONE)) ||
+        (net_dev->ip_mask == htonl(INADDR_NONE)))
+        // EINVAL
+        return -1;
+
+    err = rt_insert(net_dev->ip_addr, net_dev->ip_mask, INADDR_ANY,
+                    net_dev, 0);
+    if (err)
+        return err;
+
+    if (net_dev->ip_gw && (net_dev->ip_gw != htonl(INADDR_NONE)))
+        err = rt_insert(INADDR_ANY, INADDR_ANY, net_dev->ip_gw,
+                        net_dev, RTF_GATEWAY);
+
+    return err;
+}
+
+/*!
+ * @brief Delete all routes through the device
+ * @param net_dev Network device
+ */
+void route_dev_flush(struct net_dev_s *net_dev) {
+    for (uint8_t i = 0; i < RT_TBL_SIZE; i++) {
+        if (rt_tbl[i].net_dev == net_dev) {
+            rt_tbl[i].flags = 0;
+            rt_tbl[i].net_dev = NULL;
+        }
+    }
+    rt_cache_flush();
+}
+
+/*!
+ * @brief Find the route to destination with longest prefix match.
+ * Routes through the stopped devices are skipped.
+ * @param dst Destination IP address
+ * @return Route or \a NULL if destination is unreachable
+ */
+struct rtable_s *ip_route_output(in_addr_t dst) {
+    struct rtable_s *best = NULL;
+
+    if (rt_cache.rt && (rt_cache.dst == dst) && rt_is_up(rt_cache.rt))
+        return rt_cache.rt;
+
+    for (uint8_t i = 0; i < RT_TBL_SIZE; i++) {
+        struct rtable_s *rt = &rt_tbl[i];
+
+        if (!rt_is_up(rt) || ((dst & rt->mask) != rt->dst))
+            continue;
+        /* contiguous mask with more bits set is longer */
+        if (!best || (ntohl(rt->mask) > ntohl(best->mask)))
+            best = rt;
+    }
+
+    if (best) {
+        rt_cache.dst = dst;
+        rt_cache.rt = best;
+    }
+
+    return best;
+}
@@ -0,0 +1,56 @@
+#ifndef NETINET_ROUTE_H
+#define NETINET_ROUTE_H
+
+#include <stdint.h>
+
+#include "net/net_dev.h"
+#include "netinet/in.h"
+
+/* Number of routing table entries. May be overridden at compile time */
+#ifndef RT_TBL_SIZE
+#if defined(RAMEND) && (RAMEND < 0x1000)    // 2 KB of SRAM
+#define RT_TBL_SIZE 4
+#else
+#define RT_TBL_SIZE 6
+#endif
+#endif
+
+/* Route flags */
+#define RTF_UP      (1 << 0)    // route is usable
+#define RTF_GATEWAY (1 << 1)    // destination is reachable via gateway
+#define RTF_STATIC  (1 << 2)    // route added by user
+
+/*!
+ * @brief Routing table entry. Addresses are in network byte order
+ * @param dst Destination network
+ * @param mask Netmask of destination network
+ * @param gw Gateway (valid with RTF_GATEWAY)
+ * @param net_dev Output device
+ * @param flags Route flags (e.g. RTF_UP)
+ */
+struct rtable_s {
+    in_addr_t dst;
+    in_addr_t mask;
+    in_addr_t gw;
+    struct net_dev_s *net_dev;
+    uint8_t flags;
+};
+
+/*!
+ * @brief Get the next hop to destination
+ * @param rt Route to \p dst
+ * @param dst Destination IP address
+ * @return Next hop IP address
+ */
+static inline in_addr_t rt_nexthop(const struct rtable_s *rt, in_addr_t dst) {
+    return (rt->flags & RTF_GATEWAY) ? rt->gw : dst;
+}
+
+int8_t route_add(in_addr_t dst, in_addr_t mask, in_addr_t gw,
+                 struct net_dev_s *net_dev);
+int8_t route_del(in_addr_t dst, in_addr_t mask);
+int8_t route_dev_up(struct net_dev_s *net_dev);
+void route_dev_flush(struct net_dev_s *net_dev);
+struct rtable_s *ip_route_output(in_addr_t dst);
+
+#endif  /* !NETINET_ROUTE_H */
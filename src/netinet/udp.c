@@ -1,5 +1,7 @@
 #include "net/net.h"
+#include "net/net_dev.h"
 #include "net/socket.h"
+#include "net/checksum.h"
 #include "netinet/in.h"
 #include "netinet/ip.h"
 #include "netinet/udp.h"
@@ -14,34 +16,203 @@
  * @return Pointer to UDP header
  */
 struct udp_hdr_s *get_udp_hdr(struct net_buff_s *net_buff) {
-    return (void *)(net_buff->head + net_buff->transport_hdr_offset);
+    return nb_transport_hdr(net_buff);
+}
+
+struct udp_stats_s udp_stats;
+
+/*!
+ * @brief Queue the datagram to the socket receive queue
+ * @param sk Socket
+ * @param nb Buffer. Data points to the UDP payload
+ * @return 0 if success; 1 if drop
+ */
+static int8_t udp_queue_rcv(struct socket *sk, struct net_buff_s *nb) {
+    /* last buffers of pool are left for ARP, see nb_pool_low() */
+    if ((sk->nb_rx_q.q_len >= UDP_RX_QUEUE_LEN) || nb_pool_low()) {
+        udp_stats.rcvbuf_errors++;
+        free_net_buff(nb);
+        return NETDEV_RX_DROP;
+    }
+
+    nb->sock = sk;
+    nb_enqueue(nb, &sk->nb_rx_q);
+
+    return NETDEV_RX_SUCCESS;
+}
+
+/*!
+ * @brief Deliver broadcast or multicast datagram to all the sockets
+ * bound to its port. Each socket but the last one gets the clone
+ * @param nb Buffer. Data points to the UDP payload
+ * @param daddr Destination IP address
+ * @param dport Destination port
+ * @return 0 if success; 1 if drop
+ */
+static int8_t udp_mcast_deliver(struct net_buff_s *nb, in_addr_t daddr,
+                                in_port_t dport) {
+    struct socket *last = NULL;
+    struct socket *sk = NULL;
+
+    while ((sk = sk_lookup_bound(sk, IPPROTO_UDP, daddr, dport))) {
+        struct net_buff_s *clone;
+
+        if (last) {
+            clone = clone_net_buff(nb);
+            if (clone)
+                udp_queue_rcv(last, clone);
+        }
+        last = sk;
+    }
+
+    if (!last) {
+        udp_stats.no_ports++;
+        free_net_buff(nb);
+        return NETDEV_RX_DROP;
+    }
+
+    return udp_queue_rcv(last, nb);
+}
+
+/*!
+ * @brief Check the UDP checksum of datagram
+ * @param nb Network buffer. Data points to the UDP header
+ * @return True if checksum is valid or not computed by sender
+ */
+static inline bool udp_csum_ok(struct net_buff_s *nb) {
+    struct ip_hdr_s *iph = get_ip_hdr(nb);
+
+    /* zero checksum means that sender did not compute it */
+    if (get_udp_hdr(nb)->chks &&
+        !nb_csum_tcpudp_ok(nb, iph->ip_src, iph->ip_dst, IPPROTO_UDP)) {
+        udp_stats.in_csum_errors++;
+        return false;
+    }
+
+    return true;
+}
+
+/*!
+ * @brief UDP receive handler. Length of datagram is checked
+ * and it is queued to the socket connected to its source or bound to
+ * its destination. Checksum is checked unless the socket has
+ * SO_NO_CHECK set; it is always checked for broadcast and multicast
+ * @param nb Network buffer. Data points to the UDP header
+ * @return 0 if success; 1 if drop
+ */
+static int8_t udp_recv(struct net_buff_s *nb) {
+    struct ip_hdr_s *iph = get_ip_hdr(nb);
+    struct udp_hdr_s *udph;
+    struct socket *sk;
+    uint16_t ulen;
+
+    if (nb_len(nb) < sizeof(struct udp_hdr_s))
+        goto drop;
+
+    udph = get_udp_hdr(nb);
+    ulen = ntohs(udph->len);
+    if ((ulen < sizeof(struct udp_hdr_s)) || (ulen > nb_len(nb)))
+        goto drop;
+    trim_net_buff(nb, ulen);
+
+    if ((nb->flags.pkt_type == PKT_BROADCAST) ||
+        (nb->flags.pkt_type == PKT_MULTICAST)) {
+        if (!udp_csum_ok(nb))
+            goto drop;
+        pull_net_buff(nb, sizeof(struct udp_hdr_s));
+        return udp_mcast_deliver(nb, iph->ip_dst, udph->port_dst);
+    }
+
+    sk = sk_lookup(IPPROTO_UDP, iph->ip_src, udph->port_src,
+                   iph->ip_dst, udph->port_dst);
+    if ((!sk || !sk->no_check) && !udp_csum_ok(nb))
+        goto drop;
+    pull_net_buff(nb, sizeof(struct udp_hdr_s));
+    if (sk)
+        return udp_queue_rcv(sk, nb);
+
+    udp_stats.no_ports++;
+
+drop:
+    free_net_buff(nb);
+
+    return NETDEV_RX_DROP;
 }
 
 /*!
  * @brief Initialize UDP handler
  */
 void udp_init(void) {
-    /** TODO: set the valid handlers */
-    ip_proto_handler_add(IPPROTO_UDP, NULL);
+    ip_proto_handler_add(IPPROTO_UDP, udp_recv);
 }
 
-static int8_t udp_send(struct socket *sk) {
+/*!
+ * @brief Build UDP header and pass the buffer to IP
+ * @param sk Socket
+ * @param nb Buffer with data
+ * @param csum Partial checksum of data, computed while copying
+ * @return 0 if success
+ */
+static int8_t udp_send(struct socket *sk, struct net_buff_s *nb,
+                       uint32_t csum) {
     struct udp_hdr_s *udph;
-    struct net_buff_s *nb;
-
-    nb = sk->nb_tx_q.next;
 
     /* UDP header create */
-    udph = get_udp_hdr(nb);
+    udph = push_net_buff(nb, sizeof(struct udp_hdr_s));
+    if (!udph) {
+        free_net_buff(nb);
+        return -1;
+    }
 
     udph->port_src = sk->src_port;
     udph->port_dst = sk->dst_port;
-    udph->len = htons(nb->pkt_len - nb->transport_hdr_offset);
+    udph->len = htons(nb_len(nb));
     udph->chks = 0;
 
-    /** TODO: calculate UDP checksum */
+    /* not needed or computed by the device */
+    if (sk->no_check || (nb->flags.ip_summed == CHECKSUM_HW))
+        goto out;
 
-    return ip_send_sock(sk);
+    /* data is already summed, so only header and pseudo header are left */
+    csum = in_csum_partial(udph, sizeof(*udph), csum);
+    udph->chks = csum_tcpudp_magic(sk->src_addr ? sk->src_addr :
+                                                  nb->net_dev->ip_addr,
+                                   sk->dst_addr, nb_len(nb),
+                                   IPPROTO_UDP, csum);
+
+    /* RFC 768: zero is transmitted as all ones */
+    if (!udph->chks)
+        udph->chks = 0xFFFF;
+
+out:
+    return ip_queue_xmit(sk, nb);
+}
+
+/*!
+ * @brief Pass the buffer to \a udp_send() and convert its result
+ * @param sk Socket
+ * @param nb Buffer with data
+ * @param csum Partial checksum of data
+ * @param len Length of data
+ * @return Number of sending bytes or error
+ */
+static ssize_t udp_xmit(struct socket *sk, struct net_buff_s *nb,
+                        uint32_t csum, ssize_t len) {
+    int8_t err;
+
+    err = udp_send(sk, nb, csum);
+
+    /* queued, though device queue is congested */
+    if (err == NET_XMIT_CN)
+        err = 0;
+
+    if (err) {
+        if (err > 0)
+            err = -err;
+        return err;
+    }
+
+    return len;
 }
 
 /*!
@@ -49,21 +220,30 @@ static int8_t udp_send(struct socket *sk) {
  */
 ssize_t udp_send_msg(struct socket *restrict sk,
                      struct msghdr *restrict msg) {
-    ssize_t len = msg->msg_iov->iov_len;
-    ssize_t ulen = len;
+    size_t total = iov_length(msg->msg_iov, msg->msg_iovlen);
+    ssize_t len = total;
+    ssize_t ulen;
     struct sockaddr_in *addr_in = msg->msg_name;
     struct net_buff_s *nb;
-    int8_t err;
+    uint32_t csum;
 
     /* UDP does not support out-of-band data */
     if (msg->msg_flags & MSG_OOB)
         // EOPNOTSUPP
         return -1;
 
-    ulen += sizeof(struct udp_hdr_s);
+    /* datagram length must fit the UDP header field */
+    if (total > (size_t)(INT16_MAX - sizeof(struct udp_hdr_s)))
+        // EMSGSIZE
+        return -1;
+    ulen = len + sizeof(struct udp_hdr_s);
 
     /* verify address */
     if (addr_in) {
+        if (sk->state == SS_CONNECTED)
+            // EISCONN
+            return -1;
+
         if ((msg->msg_namelen < sizeof(*addr_in)) ||
             (addr_in->sin_port == 0))
             // EINVAL
@@ -83,18 +263,154 @@ ssize_t udp_send_msg(struct socket *restrict sk,
      */
     }
 
-    nb = ip_create_nb(sk, msg, sizeof(struct udp_hdr_s), ulen);
+    /* data is summed while copying, if checksum is needed */
+    csum = 0;
+    nb = ip_create_nb(sk, msg, sizeof(struct udp_hdr_s), ulen,
+                      sk->no_check ? NULL : &csum);
     if (!nb)
         // error
         return -1;
 
-    err = udp_send(sk);
+    return udp_xmit(sk, nb, csum, len);
+}
 
-    if (err) {
-        if (err > 0)
-            err = -err;
-        return err;
+/*!
+ * @brief Allocate the buffer for datagram to be filled in place
+ * by application
+ * @param sk Socket with destination
+ * @param len Length of data
+ * @return Buffer or \a NULL if error
+ */
+struct net_buff_s *udp_alloc_send(struct socket *sk, uint16_t len) {
+    if (!sk->dst_port)
+        // EDESTADDRREQ
+        return NULL;
+
+    return ip_alloc_nb(sk, sizeof(struct udp_hdr_s), len);
+}
+
+/*!
+ * @brief Send the datagram filled in place by application
+ * @param sk Socket
+ * @param nb Buffer from \a udp_alloc_send()
+ * @return Number of sending bytes or error
+ */
+ssize_t udp_commit_send(struct socket *sk, struct net_buff_s *nb) {
+    uint32_t csum = 0;
+
+    /* data is written by application, so it is summed here */
+    if (!sk->no_check) {
+        if (nb->net_dev->features & NETDEV_F_TXCSUM)
+            nb->flags.ip_summed = CHECKSUM_HW;
+        else
+            csum = nb_csum_partial(nb, 0, nb_len(nb), 0);
     }
 
-    return len;
+    return udp_xmit(sk, nb, csum, nb_len(nb));
+}
+
+/*!
+ * @brief Store the sender address of datagram to the message
+ * @param nb Received datagram
+ * @param msg Message with \a msg_name to fill (may be \a NULL)
+ */
+static void udp_msg_name(struct net_buff_s *nb, struct msghdr *msg) {
+    struct sockaddr_in *addr_in = msg->msg_name;
+
+    if (!addr_in)
+        return;
+
+    if (msg->msg_namelen >= sizeof(*addr_in)) {
+        addr_in->sin_family = AF_INET;
+        addr_in->sin_port = get_udp_hdr(nb)->port_src;
+        addr_in->sin_addr.s_addr = get_ip_hdr(nb)->ip_src;
+        msg->msg_namelen = sizeof(*addr_in);
+    } else {
+        msg->msg_namelen = 0;
+    }
+}
+
+/*!
+ * @brief Receive the datagram from socket queue. Datagram that is
+ * longer than \p len is truncated (MSG_TRUNC is set in \a msg_flags)
+ * @param sk Socket
+ * @param msg Message. Sender address is stored in \a msg_name, if any
+ * @param len Size of buffer
+ * @param flags Flags (MSG_PEEK)
+ * @return Number of received bytes or -1 if no datagram
+ */
+ssize_t udp_recv_msg(struct socket *restrict sk,
+                     struct msghdr *restrict msg,
+                     size_t len, uint8_t flags) {
+    struct net_buff_s *nb;
+    uint16_t copied;
+
+    /* UDP does not support out-of-band data */
+    if (flags & MSG_OOB)
+        // EOPNOTSUPP
+        return -1;
+
+    nb = nb_peek(&sk->nb_rx_q);
+    if (!nb)
+        // EAGAIN
+        return -1;
+
+    msg->msg_flags = 0;
+    copied = nb_len(nb);
+    if (copied > len) {
+        copied = len;
+        msg->msg_flags |= MSG_TRUNC;
+    }
+    load_net_buff(nb, 0, msg->msg_iov->iov_base, copied);
+    udp_msg_name(nb, msg);
+
+    if (!(flags & MSG_PEEK))
+        free_net_buff(nb_dequeue(&sk->nb_rx_q));
+
+    return copied;
+}
+
+/*!
+ * @brief Take the datagram from socket queue without copying.
+ * Datagram is made contiguous, if it is not. With MSG_PEEK the clone
+ * is lent and the datagram stays in the queue
+ * @param sk Socket
+ * @param msg Message. Sender address is stored in \a msg_name, if any
+ * @param nb Pointer to store the lent buffer. Its data is the payload
+ * @param flags Flags (MSG_PEEK)
+ * @return Length of datagram or -1 if no datagram
+ */
+ssize_t udp_recv_zc(struct socket *restrict sk,
+                    struct msghdr *restrict msg,
+                    struct net_buff_s **nb, uint8_t flags) {
+    struct net_buff_s *head;
+
+    /* UDP does not support out-of-band data */
+    if (flags & MSG_OOB)
+        // EOPNOTSUPP
+        return -1;
+
+    head = nb_peek(&sk->nb_rx_q);
+    if (!head)
+        // EAGAIN
+        return -1;
+
+    if (linearize_net_buff(head))
+        // ENOMEM
+        return -1;
+
+    if (flags & MSG_PEEK) {
+        head = clone_net_buff(head);
+        if (!head)
+            // ENOBUFS
+            return -1;
+    } else {
+        nb_dequeue(&sk->nb_rx_q);
+    }
+
+    msg->msg_flags = 0;
+    udp_msg_name(head, msg);
+    *nb = head;
+
+    return nb_len(head);
 }
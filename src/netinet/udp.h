@@ -12,7 +12,35 @@ struct udp_hdr_s {
     uint16_t chks;      // Checksum
 };
 
+/* Max. number of datagrams waiting in the socket receive queue.
+ * May be overridden at compile time */
+#ifndef UDP_RX_QUEUE_LEN
+#define UDP_RX_QUEUE_LEN 2
+#endif
+
+/*!
+ * @brief UDP statistics
+ * @param in_csum_errors Received datagrams dropped due to bad checksum
+ * @param no_ports Received datagrams with no socket on destination port
+ * @param rcvbuf_errors Received datagrams dropped due to full socket queue
+ */
+struct udp_stats_s {
+    uint16_t in_csum_errors;
+    uint16_t no_ports;
+    uint16_t rcvbuf_errors;
+};
+
+extern struct udp_stats_s udp_stats;
+
 void udp_init(void);
+ssize_t udp_recv_msg(struct socket *restrict sk,
+                     struct msghdr *restrict msg,
+                     size_t len, uint8_t flags);
+struct net_buff_s *udp_alloc_send(struct socket *sk, uint16_t len);
+ssize_t udp_commit_send(struct socket *sk, struct net_buff_s *nb);
+ssize_t udp_recv_zc(struct socket *restrict sk,
+                    struct msghdr *restrict msg,
+                    struct net_buff_s **nb, uint8_t flags);
 ssize_t udp_send_msg(struct socket *restrict sk,
                      struct msghdr *restrict msg);
 